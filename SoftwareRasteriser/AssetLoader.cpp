@@ -0,0 +1,92 @@
+#include "AssetLoader.h"
+#include "Texture.h"
+
+#include <memory>
+#include <thread>
+
+/*
+The pool's own thread count default leaves a core free for the thread that
+owns it, which helps out when it waits. That's no good here - nothing runs
+until someone waits, and the whole point is not to - so every thread asked
+for is a proper worker.
+*/
+int AssetLoader::ChooseThreadCount(int numThreads) {
+	if (numThreads < 0) {
+		numThreads = (int)std::thread::hardware_concurrency();
+	}
+	return max(numThreads, 1);
+}
+
+AssetLoader::AssetLoader(int numThreads) : threadPool(ChooseThreadCount(numThreads)) {
+}
+
+AssetLoader::~AssetLoader(void) {
+	//Destroying the pool would drop any loads still queued, breaking their
+	//promises - so they're all run first.
+	WaitForAll();
+}
+
+/*
+A ThreadPool job has to be copyable, and promises can only be moved, so each
+job holds onto its promise through a shared_ptr instead.
+*/
+MeshFuture AssetLoader::LoadMesh(const string &filename) {
+	std::shared_ptr<std::promise<Mesh*> > promise(new std::promise<Mesh*>());
+	MeshFuture future = promise->get_future().share();
+
+	threadPool.AddJob([promise, filename]() {
+		try {
+			Mesh* m = Mesh::LoadBinaryMeshFile(filename);
+			if (!m) {
+				Mesh loader;
+				m = loader.LoadMeshFile(filename);
+			}
+			promise->set_value(m);
+		}
+		catch (...) {
+			promise->set_exception(std::current_exception());
+		}
+	});
+	return future;
+}
+
+TextureFuture AssetLoader::LoadTexture(const string &filename) {
+	std::shared_ptr<std::promise<Texture*> > promise(new std::promise<Texture*>());
+	TextureFuture future = promise->get_future().share();
+
+	threadPool.AddJob([promise, filename]() {
+		try {
+			Texture* t = Texture::LoadCompressedTexture(filename);
+			if (!t) {
+				t = Texture::TextureFromTGA(filename);
+			}
+			promise->set_value(t);
+		}
+		catch (...) {
+			promise->set_exception(std::current_exception());
+		}
+	});
+	return future;
+}
+
+vector<MeshFuture> AssetLoader::LoadMeshes(const vector<string> &filenames) {
+	vector<MeshFuture> futures;
+	futures.reserve(filenames.size());
+	for (uint i = 0; i < filenames.size(); ++i) {
+		futures.push_back(LoadMesh(filenames[i]));
+	}
+	return futures;
+}
+
+vector<TextureFuture> AssetLoader::LoadTextures(const vector<string> &filenames) {
+	vector<TextureFuture> futures;
+	futures.reserve(filenames.size());
+	for (uint i = 0; i < filenames.size(); ++i) {
+		futures.push_back(LoadTexture(filenames[i]));
+	}
+	return futures;
+}
+
+void AssetLoader::WaitForAll() {
+	threadPool.WaitForJobs();
+}
@@ -0,0 +1,69 @@
+/******************************************************************************
+Class:AssetLoader
+Implements:
+Description:Loads meshes and textures in the background, on a pool of worker
+threads. Each load hands back a future straight away, so a whole list of 
+assets can be started at once, and only waited on when something actually 
+needs them - the first frame can go ahead as soon as the few assets it uses
+have turned up, rather than after everything has been loaded in order.
+
+Meshes can be in either the binary or the .asciimesh format, and are told 
+apart by their contents rather than their names. Whoever gets the asset out
+of a future owns it, exactly as if they'd loaded it themselves.
+
+-_-_-_-_-_-_-_,------,   
+_-_-_-_-_-_-_-|   /\_/\   NYANYANYAN
+-_-_-_-_-_-_-~|__( ^ .^) /
+_-_-_-_-_-_-_-""  ""   
+
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "ThreadPool.h"
+#include "Mesh.h"
+
+#include <future>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+class Texture;
+
+//NULL if the mesh or texture couldn't be loaded
+typedef std::shared_future<Mesh*>		MeshFuture;
+typedef std::shared_future<Texture*>	TextureFuture;
+
+class AssetLoader	{
+public:
+	//Loading spends most of its time waiting on the disk, so by default there's
+	//a thread per hardware thread, and always at least one
+	AssetLoader(int numThreads = -1);
+	//Finishes off any loads still in progress first
+	~AssetLoader(void);
+
+	MeshFuture		LoadMesh(const string &filename);
+	TextureFuture	LoadTexture(const string &filename);
+
+	//Starts every load in the list at once. The futures come back in the same
+	//order as the filenames.
+	vector<MeshFuture>		LoadMeshes(const vector<string> &filenames);
+	vector<TextureFuture>	LoadTextures(const vector<string> &filenames);
+
+	//Blocks until every load started so far has finished
+	void	WaitForAll();
+
+	//Doesn't block - true if get() can be called without having to wait
+	template <class T> static bool IsReady(const std::shared_future<T> &asset) {
+		return asset.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}
+
+	uint	GetThreadCount() const { return threadPool.GetThreadCount();}
+
+protected:
+	static int	ChooseThreadCount(int numThreads);
+
+	ThreadPool	threadPool;
+};
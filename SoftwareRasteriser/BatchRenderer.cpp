@@ -0,0 +1,133 @@
+#include "BatchRenderer.h"
+#include "SoftwareRasteriser.h"
+
+#include <thread>
+#include <functional>
+#include <cstring>
+#include <cstdio>
+
+BatchRenderer::BatchRenderer(uint width, uint height, uint numWorkers) {
+	this->width		= width;
+	this->height	= height;
+
+	if (numWorkers == 0) {
+		numWorkers = max(std::thread::hardware_concurrency(), 1u);
+	}
+	this->numWorkers = numWorkers;
+
+	//Twice as many slots as workers lets them carry on with the next frames 
+	//while an earlier, slower one is finishing off
+	slots.resize(numWorkers * 2);
+	for (uint i = 0; i < slots.size(); ++i) {
+		slots[i] = (Colour*)AlignedAlloc(max((size_t)width * height, (size_t)1) * sizeof(Colour), RENDER_TARGET_ALIGNMENT);
+	}
+
+	nextFrame	= 0;
+	outputFrame = 0;
+}
+
+BatchRenderer::~BatchRenderer(void) {
+	for (uint i = 0; i < slots.size(); ++i) {
+		AlignedFree(slots[i]);
+	}
+}
+
+void BatchRenderer::Render(Scene &scene, const vector<BatchFrame> &frames, const FrameCallback &output) {
+	nextFrame	= 0;
+	outputFrame = 0;
+	slotReady.assign(slots.size(), false);
+
+	vector<std::thread> workers;
+	for (uint i = 0; i < min(numWorkers, (uint)frames.size()); ++i) {
+		workers.push_back(std::thread(&BatchRenderer::WorkerLoop, this, std::ref(scene), std::cref(frames)));
+	}
+
+	std::unique_lock<std::mutex> lock(batchMutex);
+
+	while (outputFrame < frames.size()) {
+		uint slot = outputFrame % slots.size();
+
+		while (!slotReady[slot]) {
+			frameFinished.wait(lock);
+		}
+		//The slot can't be reused until it's marked as free again, so the
+		//output can safely run without holding the lock
+		lock.unlock();
+		if (output) {
+			output(slots[slot], width, height, outputFrame);
+		}
+		lock.lock();
+
+		slotReady[slot] = false;
+		++outputFrame;
+		slotFreed.notify_all();
+	}
+	lock.unlock();
+
+	for (uint i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+}
+
+void BatchRenderer::RenderToFiles(Scene &scene, const vector<BatchFrame> &frames, const string &prefix) {
+	Render(scene, frames, [&prefix](const Colour* buffer, uint w, uint h, uint frame) {
+		char number[16];
+		sprintf(number, "%05u", frame);
+
+		HeadlessTarget::WritePPM(prefix + number + ".ppm", buffer, w, h);
+	});
+}
+
+/*
+Each worker has a whole rasteriser to itself, so the rasterisers get no extra
+threads of their own - there's already one worker per core.
+*/
+void BatchRenderer::WorkerLoop(Scene &scene, const vector<BatchFrame> &frames) {
+	HeadlessTarget		target(width, height);
+	SoftwareRasteriser	r(target, 0);
+
+	Scene localScene;
+	const vector<RenderObject*> &sceneObjects = scene.GetObjects();
+	for (uint i = 0; i < sceneObjects.size(); ++i) {
+		localScene.AddObject(new RenderObject(*sceneObjects[i]));
+	}
+	const vector<RenderObject*> &objects = localScene.GetObjects();
+
+	uint frameIndex = 0;
+
+	target.SetFrameCallback([&](const Colour* buffer, uint w, uint h, uint) {
+		memcpy(slots[frameIndex % slots.size()], buffer, w * h * sizeof(Colour));
+	});
+
+	std::unique_lock<std::mutex> lock(batchMutex);
+
+	while (nextFrame < frames.size()) {
+		//Don't get so far ahead that this frame's slot is still waiting to be output
+		if (nextFrame >= outputFrame + slots.size()) {
+			slotFreed.wait(lock);
+			continue;
+		}
+		frameIndex = nextFrame++;
+		lock.unlock();
+
+		const BatchFrame &f = frames[frameIndex];
+
+		for (uint i = 0; i < objects.size(); ++i) {
+			objects[i]->modelMatrix = i < f.modelMatrices.size() ? f.modelMatrices[i] : sceneObjects[i]->modelMatrix;
+		}
+		//Otherwise the tree would depend on which frames this worker happened
+		//to render before, and so would the draw order
+		localScene.Rebuild();
+
+		r.SetProjectionMatrix(f.projectionMatrix);
+		r.SetViewMatrix(f.viewMatrix);
+
+		r.ClearBuffers();
+		localScene.Draw(r);
+		r.SwapBuffers();
+
+		lock.lock();
+		slotReady[frameIndex % slots.size()] = true;
+		frameFinished.notify_one();
+	}
+}
@@ -0,0 +1,77 @@
+/******************************************************************************
+Class:BatchRenderer
+Implements:
+Description:Renders a whole sequence of frames offline, as fast as the machine 
+can manage. Every frame of a sequence is independent once its matrices are 
+known, so rather than splitting each frame up between threads, it renders 
+whole frames at once - one per worker, each with its own HeadlessTarget, 
+SoftwareRasteriser, and copy of the scene's objects. That keeps every core 
+busy, with no waiting around at the end of each frame for the slowest tile.
+
+Finished frames are handed over strictly in order, on the thread that called
+Render, so they can be streamed straight out to disk. Workers are only allowed
+a few frames ahead of the one being output, so the memory used stays the same
+no matter how long the sequence is.
+
+-_-_-_-_-_-_-_,------,   
+_-_-_-_-_-_-_-|   /\_/\   NYANYANYAN
+-_-_-_-_-_-_-~|__( ^ .^) /
+_-_-_-_-_-_-_-""  ""   
+
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "Scene.h"
+#include "HeadlessTarget.h"
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+
+using std::vector;
+using std::string;
+
+struct BatchFrame {
+	Matrix4			viewMatrix;
+	Matrix4			projectionMatrix;
+	//One per scene object, in the order they were added. Any objects without
+	//one are left where they are in the scene.
+	vector<Matrix4>	modelMatrices;
+};
+
+class BatchRenderer	{
+public:
+	//Passing 0 workers will create one per hardware thread
+	BatchRenderer(uint width, uint height, uint numWorkers = 0);
+	~BatchRenderer(void);
+
+	//Renders every frame of the scene, and passes them to output in order. The
+	//scene's objects are copied by each worker, so aren't touched - but their
+	//meshes and textures are shared, so mustn't change until this returns.
+	void	Render(Scene &scene, const vector<BatchFrame> &frames, const FrameCallback &output);
+
+	//Renders every frame out to prefix00000.ppm, prefix00001.ppm and so on
+	void	RenderToFiles(Scene &scene, const vector<BatchFrame> &frames, const string &prefix);
+
+	uint	GetWorkerCount() const { return numWorkers;}
+
+protected:
+	void	WorkerLoop(Scene &scene, const vector<BatchFrame> &frames);
+
+	uint	width;
+	uint	height;
+	uint	numWorkers;
+
+	//Finished frames wait in here until it's their turn to be output. Frame 
+	//i always goes in slot i % the number of slots.
+	vector<Colour*>	slots;
+	vector<bool>	slotReady;
+
+	uint	nextFrame;		//Next frame for a worker to start on
+	uint	outputFrame;	//Next frame to be handed to the output
+
+	std::mutex				batchMutex;
+	std::condition_variable	frameFinished;
+	std::condition_variable	slotFreed;
+};
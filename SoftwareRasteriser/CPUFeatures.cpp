@@ -0,0 +1,67 @@
+#include "CPUFeatures.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#include <mutex>
+
+bool CPUFeatures::sse41	= false;
+bool CPUFeatures::avx2	= false;
+
+//Every rasteriser asks for the features as it's made - and the BatchRenderer
+//makes a rasteriser on every worker thread at once
+static std::once_flag detectOnce;
+
+void CPUFeatures::Detect() {
+	std::call_once(detectOnce, Query);
+}
+
+bool CPUFeatures::HasSSE41() {
+	Detect();
+	return sse41;
+}
+
+bool CPUFeatures::HasAVX2() {
+	Detect();
+	return avx2;
+}
+
+/*
+AVX2 needs checking for twice over - once to see if the CPU supports it, and 
+again to see if the OS is saving the upper halves of the ymm registers between
+context switches (bits 1 and 2 of XCR0). If it isn't, using them would go very
+badly indeed!
+*/
+void CPUFeatures::Query() {
+	unsigned int regs[4] = { 0, 0, 0, 0 }; //eax, ebx, ecx, edx
+	unsigned int maxLeaf = 0;
+
+#if defined(_MSC_VER)
+	__cpuid((int*)regs, 0);
+	maxLeaf = regs[0];
+	__cpuid((int*)regs, 1);
+#else
+	maxLeaf = __get_cpuid_max(0, 0);
+	__cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	sse41 = (regs[2] & (1 << 19)) != 0;
+
+	bool osxsave	= (regs[2] & (1 << 27)) != 0;
+	bool avx		= (regs[2] & (1 << 28)) != 0;
+
+	if (osxsave && avx && maxLeaf >= 7) {
+#if defined(_MSC_VER)
+		unsigned long long xcr0 = _xgetbv(0);
+		__cpuidex((int*)regs, 7, 0);
+#else
+		unsigned int xcrLow, xcrHigh;
+		__asm__("xgetbv" : "=a"(xcrLow), "=d"(xcrHigh) : "c"(0));
+		unsigned long long xcr0 = xcrLow;
+		__cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+		avx2 = ((xcr0 & 6) == 6) && (regs[1] & (1 << 5)) != 0;
+	}
+}
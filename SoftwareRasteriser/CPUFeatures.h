@@ -0,0 +1,40 @@
+/******************************************************************************
+Class:CPUFeatures
+Implements:
+Description:Queries which SIMD instruction sets the CPU we're running on has,
+so that the rasteriser can pick the fastest pixel kernel at run time while
+still running on older machines.
+
+The TARGET_ defines go in front of any function that uses intrinsics from a 
+newer instruction set than the compiler targets by default. Visual Studio lets
+you use any intrinsic anywhere, but GCC and clang need telling.
+
+-_-_-_-_-_-_-_,------,   
+_-_-_-_-_-_-_-|   /\_/\   NYANYANYAN
+-_-_-_-_-_-_-~|__( ^ .^) /
+_-_-_-_-_-_-_-""  ""   
+
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#if defined(_MSC_VER)
+#define TARGET_SSE41
+#define TARGET_AVX2
+#else
+#define TARGET_SSE41	__attribute__((target("sse4.1")))
+#define TARGET_AVX2		__attribute__((target("avx2")))
+#endif
+
+class CPUFeatures	{
+public:
+	static bool HasSSE41();
+	static bool HasAVX2();
+
+protected:
+	//Runs Query exactly once, however many threads ask at the same time
+	static void	Detect();
+	static void	Query();
+
+	static bool sse41;
+	static bool avx2;
+};
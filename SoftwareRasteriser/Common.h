@@ -12,6 +12,12 @@ _-_-_-_-_-_-_-""  ""
 
 #pragma once
 
+#include <cstddef>
+#include <cstdlib>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
 //It's pi(ish)...
 static const float		PI = 3.14159265358979323846f;	
 
@@ -28,9 +34,55 @@ static inline double DegToRad(const double rad)	{
 	return rad * PI / 180.0;
 };
 
-//I blame Microsoft...
-#define max(a,b)    (((a) > (b)) ? (a) : (b))
-#define min(a,b)    (((a) < (b)) ? (a) : (b))
-#define clamp(a,b,c) (a < b ? b : (a > c ? c : a))
+//I blame Microsoft... These used to be macros, but those break any standard
+//header included after this one. windows.h has its own min and max macros,
+//so the project defines NOMINMAX to keep them out of the way.
+#undef max
+#undef min
+
+template <typename T>
+static inline T max(const T &a, const T &b) {
+	return (a > b) ? a : b;
+}
+
+template <typename T>
+static inline T min(const T &a, const T &b) {
+	return (a < b) ? a : b;
+}
+
+template <typename T>
+static inline T clamp(const T &a, const T &low, const T &high) {
+	return (a < low) ? low : ((a > high) ? high : a);
+}
+
+typedef unsigned int uint;
+
+//Visual Studio 2013 doesn't have thread_local yet. Both of these only work on
+//plain old data, that doesn't need constructing!
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+//Allocates memory starting on a multiple of alignment bytes, which must be a
+//power of two. Anything from here must be freed with AlignedFree!
+static inline void* AlignedAlloc(size_t size, size_t alignment) {
+#ifdef _MSC_VER
+	return _aligned_malloc(size, alignment);
+#else
+	void* memory = NULL;
+	if (posix_memalign(&memory, max(alignment, sizeof(void*)), size) != 0) {
+		return NULL;
+	}
+	return memory;
+#endif
+}
 
-typedef unsigned int uint;
\ No newline at end of file
+static inline void AlignedFree(void* memory) {
+#ifdef _MSC_VER
+	_aligned_free(memory);
+#else
+	free(memory);
+#endif
+}
@@ -0,0 +1,337 @@
+#include "FrameWriter.h"
+#include "CPUFeatures.h"
+
+#include <immintrin.h>
+#include <cstring>
+#include <iostream>
+
+FrameWriter::FrameWriter(uint ringSize) {
+	ring.resize(max(ringSize, 1u), NULL);
+	ringFrames.resize(ring.size(), 0);
+
+	format			= FRAME_Y4M;
+	width			= 0;
+	height			= 0;
+	videoFile		= NULL;
+	ringHead		= 0;
+	ringTail		= 0;
+	framesQueued	= 0;
+	framesSubmitted	= 0;
+	framesWritten	= 0;
+	closing			= false;
+	errors			= false;
+}
+
+FrameWriter::~FrameWriter(void) {
+	Close();
+}
+
+bool FrameWriter::Open(const string &path, FrameFormat format, uint width, uint height, uint framesPerSecond) {
+	Close();
+
+	this->path		= path;
+	this->format	= format;
+	this->width		= width;
+	this->height	= height;
+
+	ringHead		= 0;
+	ringTail		= 0;
+	framesQueued	= 0;
+	framesSubmitted	= 0;
+	framesWritten	= 0;
+	closing			= false;
+	errors			= false;
+
+	if (format == FRAME_Y4M) {
+		videoFile = fopen(path.c_str(), "wb");
+		if (!videoFile) {
+			std::cout << "FrameWriter: Can't open " << path << " for writing!" << std::endl;
+			errors = true;
+			return false;
+		}
+		//C420jpeg puts the chroma samples in the middle of each 2x2 block of
+		//pixels, which is what averaging all 4 of them gives us
+		fprintf(videoFile, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n", width, height, framesPerSecond);
+	}
+
+	size_t pixels = max((size_t)width * height, (size_t)1);
+
+	for (uint i = 0; i < ring.size(); ++i) {
+		ring[i] = (Colour*)AlignedAlloc(pixels * sizeof(Colour), RENDER_TARGET_ALIGNMENT);
+	}
+
+	switch (format) {
+	case FRAME_Y4M: {
+		size_t chromaPixels = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+		converted.resize(pixels + (chromaPixels * 2));
+	} break;
+	case FRAME_PPM: converted.resize(pixels * 3); break;
+	case FRAME_PAM: converted.resize(pixels * 4); break;
+	}
+
+	writerThread = std::thread(&FrameWriter::WriterLoop, this);
+	return true;
+}
+
+void FrameWriter::Close() {
+	if (writerThread.joinable()) {
+		{
+			std::unique_lock<std::mutex> lock(ringMutex);
+			closing = true;
+		}
+		frameQueued.notify_all();
+		writerThread.join();
+	}
+
+	if (videoFile) {
+		fclose(videoFile);
+		videoFile = NULL;
+	}
+
+	for (uint i = 0; i < ring.size(); ++i) {
+		AlignedFree(ring[i]);
+		ring[i] = NULL;
+	}
+}
+
+void FrameWriter::SubmitFrame(const Colour* buffer, uint width, uint height) {
+	if (!writerThread.joinable()) {
+		return;
+	}
+	if (width != this->width || height != this->height) {
+		std::cout << "FrameWriter: Frame is " << width << "x" << height << ", expected " 
+			<< this->width << "x" << this->height << " - skipping it!" << std::endl;
+		errors = true;
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(ringMutex);
+	while (framesQueued == ring.size()) {
+		slotFreed.wait(lock);
+	}
+	uint slot = ringHead;
+	lock.unlock();
+
+	//Only this thread ever moves the head, and the writer won't touch this
+	//slot until it's been queued, so the copy can happen without the lock
+	memcpy(ring[slot], buffer, (size_t)width * height * sizeof(Colour));
+	ringFrames[slot] = framesSubmitted++;
+
+	lock.lock();
+	ringHead = (ringHead + 1) % ring.size();
+	++framesQueued;
+	lock.unlock();
+
+	frameQueued.notify_one();
+}
+
+FrameCallback FrameWriter::GetFrameCallback() {
+	return [this](const Colour* buffer, uint width, uint height, uint) {
+		SubmitFrame(buffer, width, height);
+	};
+}
+
+void FrameWriter::WriterLoop() {
+	std::unique_lock<std::mutex> lock(ringMutex);
+
+	while (true) {
+		while (framesQueued == 0 && !closing) {
+			frameQueued.wait(lock);
+		}
+		if (framesQueued == 0) {
+			return; //Closing, and everything's been written
+		}
+		uint slot = ringTail;
+		lock.unlock();
+
+		if (WriteFrame(ring[slot], ringFrames[slot])) {
+			++framesWritten;
+		}
+		else {
+			errors = true;
+		}
+
+		lock.lock();
+		ringTail = (ringTail + 1) % ring.size();
+		--framesQueued;
+		slotFreed.notify_one();
+	}
+}
+
+bool FrameWriter::WriteFrame(const Colour* buffer, uint frameIndex) {
+	if (format == FRAME_Y4M) {
+		unsigned char* yPlane = &converted[0];
+		unsigned char* uPlane = yPlane + ((size_t)width * height);
+		unsigned char* vPlane = uPlane + ((size_t)((width + 1) / 2) * ((height + 1) / 2));
+
+		ConvertToYUV420(buffer, width, height, yPlane, uPlane, vPlane);
+
+		size_t size = converted.size();
+		if (width == 0 || height == 0) {
+			size = 0;
+		}
+		return fputs("FRAME\n", videoFile) >= 0 && fwrite(&converted[0], 1, size, videoFile) == size;
+	}
+
+	//PPMs and PAMs both go top to bottom, and only differ in the alpha channel
+	uint channels = (format == FRAME_PAM) ? 4 : 3;
+
+	unsigned char* out = &converted[0];
+	for (uint y = height; y > 0; --y) {
+		const Colour* in = &buffer[(y - 1) * width];
+
+		for (uint x = 0; x < width; ++x) {
+			out[0] = in[x].r;
+			out[1] = in[x].g;
+			out[2] = in[x].b;
+			if (channels == 4) {
+				out[3] = in[x].a;
+			}
+			out += channels;
+		}
+	}
+
+	char filename[16];
+	sprintf(filename, "%05u", frameIndex);
+
+	string fullPath = path + filename + (format == FRAME_PAM ? ".pam" : ".ppm");
+
+	FILE* file = fopen(fullPath.c_str(), "wb");
+	if (!file) {
+		std::cout << "FrameWriter: Can't open " << fullPath << " for writing!" << std::endl;
+		return false;
+	}
+
+	if (format == FRAME_PAM) {
+		fprintf(file, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", width, height);
+	}
+	else {
+		fprintf(file, "P6\n%u %u\n255\n", width, height);
+	}
+
+	size_t size = (size_t)width * height * channels;
+	bool success = fwrite(&converted[0], 1, size, file) == size;
+	fclose(file);
+
+	return success;
+}
+
+/*
+Each pair of rows of the image gives two rows of Y, and one row of U and V,
+each chroma sample covering a 2x2 block of pixels. If the width or height is
+odd, the last column or row of pixels is just used twice.
+*/
+void FrameWriter::ConvertToYUV420(const Colour* buffer, uint width, uint height, unsigned char* yPlane, unsigned char* uPlane, unsigned char* vPlane) {
+	uint chromaWidth	= (width + 1) / 2;
+	uint chromaHeight	= (height + 1) / 2;
+
+	bool useSSE = CPUFeatures::HasSSE41();
+
+	for (uint cy = 0; cy < chromaHeight; ++cy) {
+		uint top	= cy * 2;
+		uint bottom = min(top + 1, height - 1);
+
+		//The buffer's rows go bottom to top, but Y4M's go top to bottom
+		const Colour* row0 = &buffer[(height - 1 - top) * width];
+		const Colour* row1 = &buffer[(height - 1 - bottom) * width];
+
+		unsigned char* yRow0	= &yPlane[top * width];
+		unsigned char* yRow1	= &yPlane[bottom * width];
+		unsigned char* uRow		= &uPlane[cy * chromaWidth];
+		unsigned char* vRow		= &vPlane[cy * chromaWidth];
+
+		uint done = 0;
+		if (useSSE) {
+			done = ConvertRowsToYUV420SSE41(row0, row1, width, yRow0, yRow1, uRow, vRow);
+		}
+		ConvertRowsToYUV420Scalar(row0, row1, done, width, yRow0, yRow1, uRow, vRow);
+	}
+}
+
+/*
+Integer BT.601, with Y in [16, 235] and U and V in [16, 240]. The chroma is
+worked out from the sum of the 4 pixels in its block, so its scale is 4 times 
+bigger - hence shifting by 10 rather than 8. The 131584 is the 128 offset and
+the rounding, both scaled up by 1024, so the sum never goes negative.
+*/
+static inline unsigned char RGBToY(const Colour &c) {
+	return (unsigned char)((((66 * c.r) + (129 * c.g) + (25 * c.b) + 128) >> 8) + 16);
+}
+
+void FrameWriter::ConvertRowsToYUV420Scalar(const Colour* row0, const Colour* row1, uint startX, uint width, unsigned char* yRow0, unsigned char* yRow1, unsigned char* uRow, unsigned char* vRow) {
+	for (uint x = startX; x < width; x += 2) {
+		uint right = min(x + 1, width - 1);
+
+		yRow0[x]		= RGBToY(row0[x]);
+		yRow0[right]	= RGBToY(row0[right]);
+		yRow1[x]		= RGBToY(row1[x]);
+		yRow1[right]	= RGBToY(row1[right]);
+
+		int r = row0[x].r + row0[right].r + row1[x].r + row1[right].r;
+		int g = row0[x].g + row0[right].g + row1[x].g + row1[right].g;
+		int b = row0[x].b + row0[right].b + row1[x].b + row1[right].b;
+
+		uRow[x / 2] = (unsigned char)(((-38 * r) - (74 * g) + (112 * b) + 131584) >> 10);
+		vRow[x / 2] = (unsigned char)(((112 * r) - (94 * g) - (18 * b) + 131584) >> 10);
+	}
+}
+
+/*
+Does 4 pixels of each row at a time, giving 2 chroma samples. Each pixel's
+bytes are widened to 16 bits, so one madd does 2 of the multiply-adds per
+pixel, and the horizontal adds finish them off - for the chroma they go on to 
+sum the 2 pixels in each block as well. Returns how many pixels were done.
+*/
+TARGET_SSE41 uint FrameWriter::ConvertRowsToYUV420SSE41(const Colour* row0, const Colour* row1, uint width, unsigned char* yRow0, unsigned char* yRow1, unsigned char* uRow, unsigned char* vRow) {
+	//Colours are stored BGRA, so the coefficients are too
+	const __m128i yCoeffs = _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0);
+	const __m128i uCoeffs = _mm_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0);
+	const __m128i vCoeffs = _mm_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0);
+
+	const __m128i yRound	= _mm_set1_epi32(128);
+	const __m128i yOffset	= _mm_set1_epi32(16);
+	const __m128i uvRound	= _mm_set1_epi32(131584);
+
+	uint x = 0;
+	for (; x + 4 <= width; x += 4) {
+		__m128i p0 = _mm_loadu_si128((const __m128i*)&row0[x]);
+		__m128i p1 = _mm_loadu_si128((const __m128i*)&row1[x]);
+
+		__m128i lo0 = _mm_cvtepu8_epi16(p0);
+		__m128i hi0 = _mm_cvtepu8_epi16(_mm_srli_si128(p0, 8));
+		__m128i lo1 = _mm_cvtepu8_epi16(p1);
+		__m128i hi1 = _mm_cvtepu8_epi16(_mm_srli_si128(p1, 8));
+
+		__m128i y0 = _mm_hadd_epi32(_mm_madd_epi16(lo0, yCoeffs), _mm_madd_epi16(hi0, yCoeffs));
+		__m128i y1 = _mm_hadd_epi32(_mm_madd_epi16(lo1, yCoeffs), _mm_madd_epi16(hi1, yCoeffs));
+
+		y0 = _mm_add_epi32(_mm_srli_epi32(_mm_add_epi32(y0, yRound), 8), yOffset);
+		y1 = _mm_add_epi32(_mm_srli_epi32(_mm_add_epi32(y1, yRound), 8), yOffset);
+
+		//Both rows of Y are packed down into one register, row 0 in the low 4 bytes
+		__m128i yBytes = _mm_packus_epi16(_mm_packus_epi32(y0, y1), _mm_setzero_si128());
+
+		int yOut0 = _mm_cvtsi128_si32(yBytes);
+		int yOut1 = _mm_extract_epi32(yBytes, 1);
+		memcpy(&yRow0[x], &yOut0, 4);
+		memcpy(&yRow1[x], &yOut1, 4);
+
+		//Adding the rows together first gives the column sums of each block
+		__m128i uLo = _mm_add_epi32(_mm_madd_epi16(lo0, uCoeffs), _mm_madd_epi16(lo1, uCoeffs));
+		__m128i uHi = _mm_add_epi32(_mm_madd_epi16(hi0, uCoeffs), _mm_madd_epi16(hi1, uCoeffs));
+		__m128i vLo = _mm_add_epi32(_mm_madd_epi16(lo0, vCoeffs), _mm_madd_epi16(lo1, vCoeffs));
+		__m128i vHi = _mm_add_epi32(_mm_madd_epi16(hi0, vCoeffs), _mm_madd_epi16(hi1, vCoeffs));
+
+		__m128i uvSums = _mm_hadd_epi32(_mm_hadd_epi32(uLo, uHi), _mm_hadd_epi32(vLo, vHi));
+		__m128i uv = _mm_srli_epi32(_mm_add_epi32(uvSums, uvRound), 10);
+
+		//u0, u1, v0, v1
+		int uvBytes = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packus_epi32(uv, uv), _mm_setzero_si128()));
+
+		uRow[x / 2]		= (unsigned char)(uvBytes);
+		uRow[x / 2 + 1] = (unsigned char)(uvBytes >> 8);
+		vRow[x / 2]		= (unsigned char)(uvBytes >> 16);
+		vRow[x / 2 + 1] = (unsigned char)(uvBytes >> 24);
+	}
+	return x;
+}
@@ -0,0 +1,107 @@
+/******************************************************************************
+Class:FrameWriter
+Implements:
+Description:Streams finished frames out to disk, either as a single Y4M video
+(which pretty much any encoder will take as input), or as a numbered series of
+PPM or PAM images, for comparing frames against each other.
+
+Converting and writing a frame can easily take longer than rendering it, so
+none of that happens on the thread submitting the frames - SubmitFrame just
+copies the frame into a free slot in a ring of buffers, and a background thread
+converts and writes them out in order. The ring and the conversion buffer are
+allocated once, in Open, so nothing is allocated per frame. If the writer 
+falls so far behind the ring fills up, SubmitFrame waits for a slot to free up.
+
+Frames should only be submitted from one thread at a time.
+
+-_-_-_-_-_-_-_,------,   
+_-_-_-_-_-_-_-|   /\_/\   NYANYANYAN
+-_-_-_-_-_-_-~|__( ^ .^) /
+_-_-_-_-_-_-_-""  ""   
+
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "Common.h"
+#include "Colour.h"
+#include "HeadlessTarget.h"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdio>
+
+using std::string;
+using std::vector;
+
+enum FrameFormat {
+	FRAME_Y4M,	//One file, 8 bit 4:2:0 YUV, BT.601 limited range
+	FRAME_PPM,	//One file per frame, 8 bit RGB
+	FRAME_PAM	//One file per frame, 8 bit RGBA
+};
+
+class FrameWriter	{
+public:
+	//How many frames can be waiting to be written before SubmitFrame blocks
+	FrameWriter(uint ringSize = 4);
+	~FrameWriter(void);
+
+	//For FRAME_Y4M, path is the video file to write. For the image sequences,
+	//it's the start of each frame's filename - frames are written to 
+	//path00000.ppm, path00001.ppm and so on.
+	bool	Open(const string &path, FrameFormat format, uint width, uint height, uint framesPerSecond = 30);
+
+	//Waits for every submitted frame to be written, and closes the output
+	void	Close();
+
+	//Takes a copy of the frame, so the buffer can be reused straight away.
+	//Rows go bottom to top, as in the rasteriser's buffers.
+	void	SubmitFrame(const Colour* buffer, uint width, uint height);
+
+	//A callback that submits every frame it's given - hand this to a 
+	//HeadlessTarget or BatchRenderer to stream everything they render
+	FrameCallback GetFrameCallback();
+
+	uint	GetFramesWritten()	const { return framesWritten;}
+	bool	HadErrors()			const { return errors;}
+
+	//Converts a bottom to top BGRA image to the planar Y, U and V a Y4M frame
+	//holds, top to bottom. The U and V planes are half the size of Y in each
+	//direction, rounded up. Uses SSE4.1, where the CPU has it.
+	static void	ConvertToYUV420(const Colour* buffer, uint width, uint height, unsigned char* yPlane, unsigned char* uPlane, unsigned char* vPlane);
+
+protected:
+	void	WriterLoop();
+	bool	WriteFrame(const Colour* buffer, uint frameIndex);
+
+	static void	ConvertRowsToYUV420Scalar(const Colour* row0, const Colour* row1, uint startX, uint width, unsigned char* yRow0, unsigned char* yRow1, unsigned char* uRow, unsigned char* vRow);
+	static uint	ConvertRowsToYUV420SSE41(const Colour* row0, const Colour* row1, uint width, unsigned char* yRow0, unsigned char* yRow1, unsigned char* uRow, unsigned char* vRow);
+
+	FrameFormat	format;
+	string		path;
+	uint		width;
+	uint		height;
+	FILE*		videoFile;
+
+	vector<Colour*>			ring;
+	vector<uint>			ringFrames;	//Index of the frame in each slot, for numbering its file
+	vector<unsigned char>	converted;	//Only ever touched by the writer thread
+
+	uint	ringHead;		//Next slot to copy a submitted frame into
+	uint	ringTail;		//Next slot to be written out
+	uint	framesQueued;
+	uint	framesSubmitted;	//Only ever touched by the submitting thread
+	bool	closing;
+
+	//Read from any thread, without the lock
+	std::atomic<uint>	framesWritten;
+	std::atomic<bool>	errors;
+
+	std::thread				writerThread;
+	std::mutex				ringMutex;
+	std::condition_variable	frameQueued;
+	std::condition_variable	slotFreed;
+};
@@ -0,0 +1,79 @@
+#include "Frustum.h"
+
+/*
+Each plane is a sum or difference of the bottom row of the matrix and one of
+the other rows - see 'Fast Extraction of Viewing Frustum Planes from the 
+World-View-Projection Matrix', by Gribb and Hartmann. Our matrices are stored 
+column major, so row i is values[i], values[i+4], values[i+8], values[i+12].
+*/
+void Frustum::FromMatrix(const Matrix4 &m) {
+	const float* v = m.values;
+
+	for (int i = 0; i < 3; ++i) {
+		planes[i * 2]		= Vector4(v[3] + v[i], v[7] + v[i + 4], v[11] + v[i + 8], v[15] + v[i + 12]);
+		planes[i * 2 + 1]	= Vector4(v[3] - v[i], v[7] - v[i + 4], v[11] - v[i + 8], v[15] - v[i + 12]);
+	}
+
+	for (int i = 0; i < 6; ++i) {
+		float length = Vector3(planes[i].x, planes[i].y, planes[i].z).Length();
+		if (length > 0.0f) {
+			planes[i] = planes[i] / length;
+		}
+	}
+}
+
+/*
+For each plane, we only need to check the corner of the box furthest along the
+plane's normal - if even that's behind the plane, the whole box must be.
+*/
+bool Frustum::InsideFrustum(const Vector3 &boxMin, const Vector3 &boxMax) const {
+	for (int i = 0; i < 6; ++i) {
+		const Vector4 &p = planes[i];
+
+		float x = p.x >= 0.0f ? boxMax.x : boxMin.x;
+		float y = p.y >= 0.0f ? boxMax.y : boxMin.y;
+		float z = p.z >= 0.0f ? boxMax.z : boxMin.z;
+
+		if ((p.x * x) + (p.y * y) + (p.z * z) + p.w < 0.0f) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Frustum::InsideFrustum(const Vector3 &centre, float radius) const {
+	for (int i = 0; i < 6; ++i) {
+		const Vector4 &p = planes[i];
+
+		if ((p.x * centre.x) + (p.y * centre.y) + (p.z * centre.z) + p.w < -radius) {
+			return false;
+		}
+	}
+	return true;
+}
+
+FrustumResult Frustum::ClassifyBox(const Vector3 &boxMin, const Vector3 &boxMax, int &planeMask) const {
+	for (int i = 0; i < 6; ++i) {
+		if (!(planeMask & (1 << i))) {
+			continue;
+		}
+		const Vector4 &p = planes[i];
+
+		//The corners furthest along, and furthest against, the plane normal
+		Vector3 furthest(	p.x >= 0.0f ? boxMax.x : boxMin.x,
+							p.y >= 0.0f ? boxMax.y : boxMin.y,
+							p.z >= 0.0f ? boxMax.z : boxMin.z);
+
+		Vector3 nearest(	p.x >= 0.0f ? boxMin.x : boxMax.x,
+							p.y >= 0.0f ? boxMin.y : boxMax.y,
+							p.z >= 0.0f ? boxMin.z : boxMax.z);
+
+		if ((p.x * furthest.x) + (p.y * furthest.y) + (p.z * furthest.z) + p.w < 0.0f) {
+			return FRUSTUM_OUTSIDE;
+		}
+		if ((p.x * nearest.x) + (p.y * nearest.y) + (p.z * nearest.z) + p.w >= 0.0f) {
+			planeMask &= ~(1 << i);
+		}
+	}
+	return planeMask ? FRUSTUM_INTERSECTS : FRUSTUM_INSIDE;
+}
@@ -0,0 +1,60 @@
+/******************************************************************************
+Class:Frustum
+Implements:
+Description:The 6 planes of a view frustum, pulled straight out of a
+projection matrix. If the matrix given includes an object's model matrix too,
+the planes end up in that object's local space, so its mesh bounds can be
+tested against them without having to transform them first.
+
+-_-_-_-_-_-_-_,------,   
+_-_-_-_-_-_-_-|   /\_/\   NYANYANYAN
+-_-_-_-_-_-_-~|__( ^ .^) /
+_-_-_-_-_-_-_-""  ""   
+
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "Matrix4.h"
+#include "Vector3.h"
+#include "Vector4.h"
+
+enum FrustumResult {
+	FRUSTUM_OUTSIDE,
+	FRUSTUM_INTERSECTS,
+	FRUSTUM_INSIDE
+};
+
+//A plane mask with every plane set, for the first call to ClassifyBox
+static const int FRUSTUM_ALL_PLANES = 63;
+
+class Frustum	{
+public:
+	Frustum(void) {}
+	Frustum(const Matrix4 &m) {
+		FromMatrix(m);
+	}
+	~Frustum(void) {}
+
+	//Builds the planes from a (model)viewprojection matrix
+	void	FromMatrix(const Matrix4 &m);
+
+	//Returns false if the box is entirely outside of any of the planes. Boxes
+	//that are near a corner of the frustum may still pass, even if they are 
+	//outside - it's a conservative test.
+	bool	InsideFrustum(const Vector3 &boxMin, const Vector3 &boxMax) const;
+
+	//Returns false if the sphere is entirely outside of any of the planes
+	bool	InsideFrustum(const Vector3 &centre, float radius) const;
+
+	//Like InsideFrustum, but also tells you if the box is entirely inside. 
+	//planeMask has a bit set for each plane that needs testing against, and
+	//bits are cleared for any plane the box is entirely inside of - so when
+	//walking down a hierarchy of boxes, children can skip the planes their
+	//parent was already found to be inside of.
+	FrustumResult ClassifyBox(const Vector3 &boxMin, const Vector3 &boxMax, int &planeMask) const;
+
+protected:
+	//Each plane is stored as a normal (xyz) and distance (w), with the normal
+	//pointing into the frustum
+	Vector4 planes[6];
+};
@@ -0,0 +1,54 @@
+#include "HeadlessTarget.h"
+
+#include <cstdio>
+#include <iostream>
+
+HeadlessTarget::HeadlessTarget(uint width, uint height) : RenderTarget(width, height) {
+	frameCount = 0;
+}
+
+HeadlessTarget::~HeadlessTarget(void) {
+}
+
+void HeadlessTarget::PresentBuffer(Colour*buffer) {
+	if (frameCallback) {
+		frameCallback(buffer, screenWidth, screenHeight, frameCount);
+	}
+
+	if (!outputPrefix.empty()) {
+		char number[16];
+		sprintf(number, "%05u", frameCount);
+
+		WritePPM(outputPrefix + number + ".ppm", buffer, screenWidth, screenHeight);
+	}
+	++frameCount;
+}
+
+bool HeadlessTarget::WritePPM(const string &filename, const Colour* buffer, uint width, uint height) {
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (!file) {
+		std::cout << "HeadlessTarget: Can't open " << filename << " for writing!" << std::endl;
+		return false;
+	}
+
+	fprintf(file, "P6\n%u %u\n255\n", width, height);
+
+	vector<unsigned char> row(max(width * 3, 1u));
+
+	bool success = true;
+
+	//PPMs go top to bottom, so start from the last row
+	for (uint y = height; y > 0 && success; --y) {
+		const Colour* in = &buffer[(y - 1) * width];
+
+		for (uint x = 0; x < width; ++x) {
+			row[(x * 3) + 0] = in[x].r;
+			row[(x * 3) + 1] = in[x].g;
+			row[(x * 3) + 2] = in[x].b;
+		}
+		success = fwrite(&row[0], 1, width * 3, file) == width * 3;
+	}
+	fclose(file);
+
+	return success;
+}
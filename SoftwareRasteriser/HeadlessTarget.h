@@ -0,0 +1,66 @@
+/******************************************************************************
+Class:HeadlessTarget
+Implements:RenderTarget
+Description:A RenderTarget with no window at all, for running the rasteriser
+somewhere without a screen, like a Linux render farm. Each presented frame is
+handed to a callback, and can also be written out to a numbered series of PPM
+files.
+
+The callback is run on whichever thread called SwapBuffers, and the buffer it's
+given will be drawn over once the frame after next starts - copy out anything
+you want to keep!
+
+-_-_-_-_-_-_-_,------,   
+_-_-_-_-_-_-_-|   /\_/\   NYANYANYAN
+-_-_-_-_-_-_-~|__( ^ .^) /
+_-_-_-_-_-_-_-""  ""   
+
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "RenderTarget.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+//Given each presented frame - rows bottom to top, like the buffers themselves
+typedef std::function<void(const Colour* buffer, uint width, uint height, uint frame)> FrameCallback;
+
+class HeadlessTarget : public RenderTarget	{
+public:
+	HeadlessTarget(uint width, uint height);
+	~HeadlessTarget(void);
+
+	void	SetFrameCallback(const FrameCallback &callback) {
+		frameCallback = callback;
+	}
+
+	//Every frame presented from now on will be written to prefix00000.ppm,
+	//prefix00001.ppm and so on. An empty prefix stops writing them.
+	void	SetOutputPrefix(const string &prefix) {
+		outputPrefix = prefix;
+	}
+
+	//There's no window to resize, so this is up to you. Any rasteriser using
+	//this target will pick up the new size the next time it clears or draws.
+	void	Resize(uint width, uint height) {
+		AllocateBuffers(width, height);
+	}
+
+	virtual void PresentBuffer(Colour*buffer);
+
+	//How many frames have been presented so far
+	uint	GetFrameCount() const { return frameCount;}
+
+	//Writes a buffer out as a binary PPM, flipping it so it's the right way up
+	static bool	WritePPM(const string &filename, const Colour* buffer, uint width, uint height);
+
+protected:
+	FrameCallback	frameCallback;
+	string			outputPrefix;
+	uint			frameCount;
+};
@@ -0,0 +1,108 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(void) {
+	data			= NULL;
+	size			= 0;
+#ifdef _WIN32
+	fileHandle		= INVALID_HANDLE_VALUE;
+	mappingHandle	= NULL;
+#endif
+}
+
+MappedFile::~MappedFile(void) {
+	Close();
+}
+
+#ifdef _WIN32
+bool MappedFile::Open(const string &filename) {
+	Close();
+
+	fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, 
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0 || 
+		(unsigned long long)fileSize.QuadPart > (size_t)-1) {
+		Close();
+		return false;
+	}
+
+	mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mappingHandle) {
+		Close();
+		return false;
+	}
+
+	data = (const unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (!data) {
+		Close();
+		return false;
+	}
+	size = (size_t)fileSize.QuadPart;
+	return true;
+}
+
+void MappedFile::Close() {
+	if (data) {
+		UnmapViewOfFile(data);
+	}
+	if (mappingHandle) {
+		CloseHandle(mappingHandle);
+	}
+	if (fileHandle != INVALID_HANDLE_VALUE) {
+		CloseHandle(fileHandle);
+	}
+	data			= NULL;
+	size			= 0;
+	fileHandle		= INVALID_HANDLE_VALUE;
+	mappingHandle	= NULL;
+}
+#else
+//Once the mapping exists, it keeps the file alive by itself, so the file
+//descriptor can be closed straight away.
+bool MappedFile::Open(const string &filename) {
+	Close();
+
+	int file = open(filename.c_str(), O_RDONLY);
+	if (file < 0) {
+		return false;
+	}
+
+	struct stat fileInfo;
+	if (fstat(file, &fileInfo) != 0 || fileInfo.st_size <= 0) {
+		close(file);
+		return false;
+	}
+
+	void* mapping = mmap(NULL, (size_t)fileInfo.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+
+	if (mapping == MAP_FAILED) {
+		return false;
+	}
+	data = (const unsigned char*)mapping;
+	size = (size_t)fileInfo.st_size;
+	return true;
+}
+
+void MappedFile::Close() {
+	if (data) {
+		munmap((void*)data, size);
+	}
+	data = NULL;
+	size = 0;
+}
+#endif
@@ -0,0 +1,48 @@
+/******************************************************************************
+Class:MappedFile
+Implements:
+Description:Maps a whole file into memory, read only, so it can be used in
+place without being read in and copied first. Pages of the file are only
+loaded when they're first touched, and a file that's already in the OS file
+cache costs next to nothing to open.
+
+Whatever is pointed to by GetData stays valid until the file is closed, or 
+the MappedFile is deleted.
+
+-_-_-_-_-_-_-_,------,   
+_-_-_-_-_-_-_-|   /\_/\   NYANYANYAN
+-_-_-_-_-_-_-~|__( ^ .^) /
+_-_-_-_-_-_-_-""  ""   
+
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <string>
+
+#include "Common.h"
+
+using std::string;
+
+class MappedFile	{
+public:
+	MappedFile(void);
+	~MappedFile(void);
+
+	//Returns false if the file can't be opened, or is empty
+	bool	Open(const string &filename);
+	void	Close();
+
+	bool	IsOpen() const { return data != NULL;}
+
+	const unsigned char*	GetData() const { return data;}
+	size_t					GetSize() const { return size;}
+
+protected:
+	const unsigned char*	data;
+	size_t					size;
+
+#ifdef _WIN32
+	void*	fileHandle;		//Kept as void* so windows.h isn't dragged in here
+	void*	mappingHandle;
+#endif
+};
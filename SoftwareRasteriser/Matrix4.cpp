@@ -1,4 +1,7 @@
 #include "Matrix4.h"
+#include "CPUFeatures.h"
+
+#include <immintrin.h>
 
 Matrix4::Matrix4(void)	{
 	ToIdentity();
@@ -157,8 +160,6 @@ Matrix4 Matrix4::Inverse()	{
 
 	Matrix4 mat = *this;
 
-	mat.values[0];
-
 	// 2x2 sub-determinants required to calculate 4x4 determinant
 	float det2_01_01 = mat.values[0] * mat.values[5] - mat.values[1] * mat.values[4];
 	float det2_01_02 = mat.values[0] * mat.values[6] - mat.values[2] * mat.values[4];
@@ -230,4 +231,136 @@ Matrix4 Matrix4::Inverse()	{
 	mat.values[15] = + det3_201_012 * invDet;
 
 	return mat;
-}
\ No newline at end of file
+}
+
+/*
+Each output component is a sum of the x, y, z and w registers, weighted by a
+single matrix value, in the same order as operator* adds them up - so the 
+results match it exactly. They're then transposed back into xyzw structures.
+*/
+static inline void TransformComponentsSSE(const float* m, __m128 x, __m128 y, __m128 z, __m128 w, Vector4* out) {
+	__m128 result[4];
+	for (int i = 0; i < 4; ++i) {
+		result[i] = _mm_mul_ps(x, _mm_set1_ps(m[i]));
+		result[i] = _mm_add_ps(result[i], _mm_mul_ps(y, _mm_set1_ps(m[i + 4])));
+		result[i] = _mm_add_ps(result[i], _mm_mul_ps(z, _mm_set1_ps(m[i + 8])));
+		result[i] = _mm_add_ps(result[i], _mm_mul_ps(w, _mm_set1_ps(m[i + 12])));
+	}
+	_MM_TRANSPOSE4_PS(result[0], result[1], result[2], result[3]);
+
+	for (int i = 0; i < 4; ++i) {
+		_mm_storeu_ps(&out[i].x, result[i]);
+	}
+}
+
+//Vertices come in as xyzw structures, so each group of 4 is transposed into 
+//registers of 4 xs, 4 ys and so on first.
+static inline void TransformFourVerticesSSE(const float* m, const Vector4* in, Vector4* out) {
+	__m128 x = _mm_loadu_ps(&in[0].x);
+	__m128 y = _mm_loadu_ps(&in[1].x);
+	__m128 z = _mm_loadu_ps(&in[2].x);
+	__m128 w = _mm_loadu_ps(&in[3].x);
+	_MM_TRANSPOSE4_PS(x, y, z, w);
+
+	TransformComponentsSSE(m, x, y, z, w, out);
+}
+
+/*
+The same again, 8 at a time. AVX2 shuffles only work within each 128 bit
+half, so transposing back leaves vertices 0-3 in the low halves of the 
+registers, and 4-7 in the high halves.
+*/
+TARGET_AVX2 static inline void TransformComponentsAVX2(const float* m, __m256 x, __m256 y, __m256 z, __m256 w, Vector4* out) {
+	__m256 result[4];
+	for (int i = 0; i < 4; ++i) {
+		result[i] = _mm256_mul_ps(x, _mm256_set1_ps(m[i]));
+		result[i] = _mm256_add_ps(result[i], _mm256_mul_ps(y, _mm256_set1_ps(m[i + 4])));
+		result[i] = _mm256_add_ps(result[i], _mm256_mul_ps(z, _mm256_set1_ps(m[i + 8])));
+		result[i] = _mm256_add_ps(result[i], _mm256_mul_ps(w, _mm256_set1_ps(m[i + 12])));
+	}
+
+	__m256 t0 = _mm256_unpacklo_ps(result[0], result[1]);
+	__m256 t1 = _mm256_unpackhi_ps(result[0], result[1]);
+	__m256 t2 = _mm256_unpacklo_ps(result[2], result[3]);
+	__m256 t3 = _mm256_unpackhi_ps(result[2], result[3]);
+
+	__m256 r0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 r1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+	__m256 r2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 r3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+
+	_mm_storeu_ps(&out[0].x, _mm256_castps256_ps128(r0));
+	_mm_storeu_ps(&out[1].x, _mm256_castps256_ps128(r1));
+	_mm_storeu_ps(&out[2].x, _mm256_castps256_ps128(r2));
+	_mm_storeu_ps(&out[3].x, _mm256_castps256_ps128(r3));
+	_mm_storeu_ps(&out[4].x, _mm256_extractf128_ps(r0, 1));
+	_mm_storeu_ps(&out[5].x, _mm256_extractf128_ps(r1, 1));
+	_mm_storeu_ps(&out[6].x, _mm256_extractf128_ps(r2, 1));
+	_mm_storeu_ps(&out[7].x, _mm256_extractf128_ps(r3, 1));
+}
+
+//Loading vertices 0-3 into the low halves and 4-7 into the high halves, the
+//in-lane transpose gives registers of x0-x7, y0-y7 and so on, in order.
+TARGET_AVX2 static inline void TransformEightVerticesAVX2(const float* m, const Vector4* in, Vector4* out) {
+	__m256 r0 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&in[0].x)), _mm_loadu_ps(&in[4].x), 1);
+	__m256 r1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&in[1].x)), _mm_loadu_ps(&in[5].x), 1);
+	__m256 r2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&in[2].x)), _mm_loadu_ps(&in[6].x), 1);
+	__m256 r3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&in[3].x)), _mm_loadu_ps(&in[7].x), 1);
+
+	__m256 t0 = _mm256_unpacklo_ps(r0, r1);
+	__m256 t1 = _mm256_unpackhi_ps(r0, r1);
+	__m256 t2 = _mm256_unpacklo_ps(r2, r3);
+	__m256 t3 = _mm256_unpackhi_ps(r2, r3);
+
+	__m256 x = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 y = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+	__m256 z = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 w = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+
+	TransformComponentsAVX2(m, x, y, z, w, out);
+}
+
+TARGET_AVX2 static size_t TransformVerticesAVX2(const float* m, const Vector4* in, Vector4* out, size_t n) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		TransformEightVerticesAVX2(m, &in[i], &out[i]);
+	}
+	return i;
+}
+
+//Straight from the streams, 8 consecutive vertices are just one load from each
+TARGET_AVX2 static size_t TransformStreamsAVX2(const float* m, const float* x, const float* y, const float* z, const float* w, Vector4* out, size_t n) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		TransformComponentsAVX2(m, _mm256_loadu_ps(&x[i]), _mm256_loadu_ps(&y[i]), _mm256_loadu_ps(&z[i]), _mm256_loadu_ps(&w[i]), &out[i]);
+	}
+	return i;
+}
+
+void Matrix4::TransformVertices(const Vector4* in, Vector4* out, size_t n) const {
+	size_t i = 0;
+
+	if (CPUFeatures::HasAVX2()) {
+		i = TransformVerticesAVX2(values, in, out, n);
+	}
+	for (; i + 4 <= n; i += 4) {
+		TransformFourVerticesSSE(values, &in[i], &out[i]);
+	}
+	for (; i < n; ++i) {
+		out[i] = (*this) * in[i];
+	}
+}
+
+void Matrix4::TransformVertices(const float* x, const float* y, const float* z, const float* w, Vector4* out, size_t n) const {
+	size_t i = 0;
+
+	if (CPUFeatures::HasAVX2()) {
+		i = TransformStreamsAVX2(values, x, y, z, w, out, n);
+	}
+	for (; i + 4 <= n; i += 4) {
+		TransformComponentsSSE(values, _mm_loadu_ps(&x[i]), _mm_loadu_ps(&y[i]), _mm_loadu_ps(&z[i]), _mm_loadu_ps(&w[i]), &out[i]);
+	}
+	for (; i < n; ++i) {
+		out[i] = (*this) * Vector4(x[i], y[i], z[i], w[i]);
+	}
+}
@@ -16,7 +16,10 @@ _-_-_-_-_-_-_-""  ""
 #pragma once
 
 #include <iostream>
-#include "common.h"
+#include <cstddef>
+#include <cstring>
+#include <xmmintrin.h>
+#include "Common.h"
 #include "Vector3.h"
 #include "Vector4.h"
 
@@ -118,23 +121,31 @@ public:
 		Vector4 out(0,0,0,1);
 
 		if(column < 3) {
-			memcpy(&out,&values[4*column],sizeof(Vector4));
+			memcpy((void*)&out,&values[4*column],sizeof(Vector4));
 		}
 
 		return out;
 	}
 
 	//Multiplies 'this' matrix by matrix 'a'. Performs the multiplication in 'OpenGL' order (ie, backwards)
+	//Each column of the result is our columns, weighted by that column of b - 
+	//so with a whole column in an SSE register, it's just 4 multiply-adds.
 	inline Matrix4 operator*(const Matrix4 &b) const{	
+		__m128 col0 = _mm_loadu_ps(&values[0]);
+		__m128 col1 = _mm_loadu_ps(&values[4]);
+		__m128 col2 = _mm_loadu_ps(&values[8]);
+		__m128 col3 = _mm_loadu_ps(&values[12]);
+
 		Matrix4 out;
 		for(unsigned int col = 0; col < 4; ++col) {
-			for(unsigned int row = 0; row < 4; ++row) {
-				int current = row + (col*4);
-				out.values[row + (col*4)] = 0.0f;
-				for(unsigned int i = 0; i < 4; ++i) {
-					out.values[row + (col*4)] += this->values[row+(i*4)] * b.values[(col*4)+i];
-				}
-			}
+			const float* bCol = &b.values[col * 4];
+
+			__m128 result = _mm_mul_ps(col0, _mm_set1_ps(bCol[0]));
+			result = _mm_add_ps(result, _mm_mul_ps(col1, _mm_set1_ps(bCol[1])));
+			result = _mm_add_ps(result, _mm_mul_ps(col2, _mm_set1_ps(bCol[2])));
+			result = _mm_add_ps(result, _mm_mul_ps(col3, _mm_set1_ps(bCol[3])));
+
+			_mm_storeu_ps(&out.values[col * 4], result);
 		}
 		return out;
 	}
@@ -158,14 +169,26 @@ public:
 	};
 
 	inline Vector4 operator*(const Vector4 &v) const {
-		return Vector4(
-			v.x*values[0] + v.y*values[4] + v.z*values[8]  +v.w * values[12],
-			v.x*values[1] + v.y*values[5] + v.z*values[9]  +v.w * values[13],
-			v.x*values[2] + v.y*values[6] + v.z*values[10] +v.w * values[14],
-			v.x*values[3] + v.y*values[7] + v.z*values[11] +v.w * values[15]
-		);
+		__m128 result = _mm_mul_ps(_mm_loadu_ps(&values[0]), _mm_set1_ps(v.x));
+		result = _mm_add_ps(result, _mm_mul_ps(_mm_loadu_ps(&values[4]),  _mm_set1_ps(v.y)));
+		result = _mm_add_ps(result, _mm_mul_ps(_mm_loadu_ps(&values[8]),  _mm_set1_ps(v.z)));
+		result = _mm_add_ps(result, _mm_mul_ps(_mm_loadu_ps(&values[12]), _mm_set1_ps(v.w)));
+
+		Vector4 out;
+		_mm_storeu_ps(&out.x, result);
+		return out;
 	};
 
+	//Transforms n vertices by this matrix, giving the same results as using
+	//operator* on each in turn. in and out may be the same array. Does 4 
+	//vertices at a time with SSE, or 8 with AVX2 where the CPU has it.
+	void	TransformVertices(const Vector4* in, Vector4* out, size_t n) const;
+
+	//The same, but reading the vertices from separate x, y, z and w arrays, as
+	//a VERTEX_SOA Mesh stores them. No shuffling is needed to get them into 
+	//registers, so this is the faster of the two.
+	void	TransformVertices(const float* x, const float* y, const float* z, const float* w, Vector4* out, size_t n) const;
+
 	//Handy string output for the matrix. Can get a bit messy, but better than nothing!
 	inline friend std::ostream& operator<<(std::ostream& o, const Matrix4& m){
 		o << "Mat4(";
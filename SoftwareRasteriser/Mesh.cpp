@@ -1,18 +1,50 @@
 #include "Mesh.h"
 
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <cmath>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+using std::vector;
+
 Mesh::Mesh(void)	{
 	type			= PRIMITIVE_POINTS;
 
 	numVertices		= 0;
 
+	layout			= VERTEX_AOS;
 	vertices		= NULL;
 	colours			= NULL;
+
+	for (int i = 0; i < 4; ++i) {
+		positionStreams[i] = NULL;
+	}
 	textureCoords	= NULL;
+
+	indexType		= INDEX_NONE;
+	numIndices		= 0;
+	indices16		= NULL;
+	indices32		= NULL;
+
+	mappedFile		= NULL;
+
+	boundsRadius	= 0.0f;
 }
 
 Mesh::~Mesh(void)	{
+	if (mappedFile) {
+		delete mappedFile;
+		return;
+	}
 	delete[] vertices;
+	AlignedFree(positionStreams[0]);
 	delete[] colours;
+	delete[] indices16;
+	delete[] indices32;
 	delete[] textureCoords;
 }
 
@@ -32,6 +64,7 @@ Mesh * Mesh::GenerateLine(const Vector3 &from, const Vector3 &to) {
 
 		m->type = PRIMITIVE_LINES;
 	
+		m->CalculateBounds();
 		return m;
 	
 }
@@ -60,6 +93,7 @@ Mesh * Mesh::GenerateTriangle() {
 	m->textureCoords[1] = Vector2(0.5f, 1.0f);
 	m->textureCoords[2] = Vector2(1.0f, 0.0f);
 
+		m->CalculateBounds();
 		return m;
 	
 }
@@ -81,7 +115,10 @@ Mesh* Mesh::GenerateStars() {
 
 	}
 
-
+	//Points are only ever transformed and written out, so streaming them in
+	//from separate arrays is as fast as they can get
+	m->ConvertToSoA();
+	m->CalculateBounds();
 	return m;
 
 }
@@ -109,46 +146,760 @@ Mesh * Mesh::GenerateShapes(const Vector3 &A1, const Vector3 &B1, const Vector3
 
 	m->type = PRIMITIVE_LINE_LOOPS;
 
+	m->CalculateBounds();
 	return m;
 
 }
 
+/*
+Splits an .asciimesh file, already in memory, up into numbers. This is much
+faster than using ifstream's >> operators, as there's no locale to look up,
+and no virtual calls per character - and unlike them, failing is explicit.
+The text must end with a 0, which is what stops every loop running off the
+end, without having to check for it on every character. Raw colour bytes can
+be 0 too, so they're the one thing that checks against the real end.
+*/
+struct MeshTokenizer {
+	const char* current;
+	const char* end;
+
+	static inline bool IsDigit(char c) {
+		return (unsigned char)(c - '0') < 10;
+	}
+
+	inline void SkipWhitespace() {
+		while (*current == ' ' || *current == '\n' || *current == '\r' || *current == '\t') {
+			++current;
+		}
+	}
+
+	bool ReadUint(uint &out) {
+		SkipWhitespace();
+		if (!IsDigit(*current)) {
+			return false;
+		}
+		unsigned long long value = 0;
+		while (IsDigit(*current)) {
+			value = (value * 10) + (*current++ - '0');
+			if (value > 0xFFFFFFFFull) {
+				return false;
+			}
+		}
+		out = (uint)value;
+		return true;
+	}
+
+	/*
+	Up to 18 significant digits are kept in an integer, then scaled by a power
+	of 10 in double precision. That's a few bits more accurate than a float 
+	needs, so rounding it to a float gives the right answer - unless it landed
+	very nearly halfway between two floats, where those last few bits of error
+	could send it either way. Those (and tiny denormal numbers) are handed to
+	strtof instead, which gets it right, but is far slower. It basically never
+	happens with the short numbers found in mesh files, anyway.
+	*/
+	bool ReadFloat(float &out) {
+		static const double powersOf10[] = {
+			1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+		static const double inversePowersOf10[] = {
+			1e-0,  1e-1,  1e-2,  1e-3,  1e-4,  1e-5,  1e-6,  1e-7,  1e-8,  1e-9,  1e-10, 1e-11,
+			1e-12, 1e-13, 1e-14, 1e-15, 1e-16, 1e-17, 1e-18, 1e-19, 1e-20, 1e-21, 1e-22
+		};
+		SkipWhitespace();
+		const char* start = current;
+
+		bool negative = (*current == '-');
+		if (*current == '-' || *current == '+') {
+			++current;
+		}
+
+		unsigned long long	mantissa	= 0;
+		int					exponent	= 0;
+		const char*			digitsStart	= current;
+
+		for (; IsDigit(*current); ++current) {
+			if (mantissa < 100000000000000000ull) {
+				mantissa = (mantissa * 10) + (*current - '0');
+			}
+			else {
+				++exponent;	//Too many digits to keep, but they still count
+			}
+		}
+		bool anyDigits = (current != digitsStart);
+
+		if (*current == '.') {
+			++current;
+			anyDigits |= IsDigit(*current);
+			for (; IsDigit(*current); ++current) {
+				if (mantissa < 100000000000000000ull) {
+					mantissa = (mantissa * 10) + (*current - '0');
+					--exponent;
+				}
+			}
+		}
+		if (!anyDigits) {
+			return false;
+		}
+		if (*current == 'e' || *current == 'E') {
+			++current;
+			bool negativeExponent = (*current == '-');
+			if (*current == '-' || *current == '+') {
+				++current;
+			}
+			if (!IsDigit(*current)) {
+				return false;
+			}
+			int e = 0;
+			for (; IsDigit(*current); ++current) {
+				e = min((e * 10) + (*current - '0'), 10000);
+			}
+			exponent += negativeExponent ? -e : e;
+		}
+		if (mantissa == 0) {
+			out = negative ? -0.0f : 0.0f;	//Whatever the exponent - 0e400 would be 0 * inf = NaN!
+			return true;
+		}
+
+		double value = (double)mantissa;
+		if (exponent < 0) {
+			value = (exponent >= -22) ? value * inversePowersOf10[-exponent] : value * pow(10.0, exponent);
+		}
+		else if (exponent > 0) {
+			value = (exponent <= 22) ? value * powersOf10[exponent] : value * pow(10.0, exponent);
+		}
+
+		//Rounding to a float drops the bottom 29 bits of the double's mantissa.
+		//If they're (very nearly) exactly half, it could go either way.
+		unsigned long long bits;
+		memcpy(&bits, &value, sizeof(double));
+		unsigned long long droppedBits = bits & 0x1FFFFFFFull;
+
+		if ((droppedBits - (0x10000000ull - 8)) <= 16 || (value != 0.0 && value < 1.2e-38)) {
+			char	number[64];
+			size_t	length = (size_t)(current - start);
+			if (length < sizeof(number)) {
+				memcpy(number, start, length);
+				number[length] = 0;
+				out = strtof(number, NULL);
+				return true;
+			}
+		}
+		//Anything from halfway between FLT_MAX and 2^128 up rounds to infinity,
+		//as it does in strtof - casting a double that big to a float is undefined
+		if (value >= 3.4028235677973366e38) {
+			out = negative ? -HUGE_VALF : HUGE_VALF;
+			return true;
+		}
+		float result = (float)value;
+		out = negative ? -result : result;
+		return true;
+	}
+
+	//Colour channels are either written as numbers, or as a single raw byte
+	//holding the channel's value - the meshes we've got use both.
+	bool ReadColourChannel(unsigned char &out) {
+		SkipWhitespace();
+		if (current >= end) {
+			return false;
+		}
+		if (IsDigit(*current)) {
+			uint value;
+			if (!ReadUint(value) || value > 255) {
+				return false;
+			}
+			out = (unsigned char)value;
+			return true;
+		}
+		out = (unsigned char)*current++;
+		return true;
+	}
+};
+
+/*
+An .asciimesh file is the number of vertices, then whether it has texture
+coordinates and colours (as 0 or 1), followed by every vertex's position as
+x y z, then their colours as r g b a, if it has them, and finally their 
+texture coordinates as u v, again only if it has them. Every 3 vertices make 
+up a triangle.
+*/
 Mesh * Mesh::LoadMeshFile(const string & filename) {
-	ifstream f(filename);
-	
-		if (!f) {
+	std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
+
+	//The whole file is read in at once, with a 0 on the end for the tokenizer
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (!file) {
+		std::cout << "LoadMeshFile: Can't open " << filename << std::endl;
 		return NULL;
-		
 	}
-	
-		Mesh *m = new Mesh();
-	m->type = PRIMITIVE_TRIANGLES;
-	f >> m->numVertices;
-	
-		int hasTex = 0;
-	int hasColour = 0;
-	
-		f >> hasTex; 
-	f >> hasColour;
-	
-	 m->vertices = new Vector4[m->numVertices];
-	m->textureCoords = new Vector2[m->numVertices];
-	m->colours = new Colour[m->numVertices];
-	
-		for (int i = 0; i < m->numVertices; ++i) {
-		f >> m->vertices[i].x;
-		f >> m->vertices[i].y;
-		f >> m->vertices[i].z;
-		
+	fseek(file, 0, SEEK_END);
+	long fileSize = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	if (fileSize < 0) {
+		fclose(file);
+		std::cout << "LoadMeshFile: Can't read " << filename << std::endl;
+		return NULL;
+	}
+	char*	text		= new char[fileSize + 1];
+	size_t	bytesRead	= fread(text, 1, (size_t)fileSize, file);
+	fclose(file);
+
+	text[bytesRead] = 0;
+
+	MeshTokenizer tokens;
+	tokens.current	= text;
+	tokens.end		= text + bytesRead;
+
+	uint numVertices	= 0;
+	uint hasTex			= 0;
+	uint hasColour		= 0;
+
+	bool validHeader = tokens.ReadUint(numVertices) && tokens.ReadUint(hasTex) && tokens.ReadUint(hasColour);
+
+	//Every position takes at least 6 characters - 3 digits and 3 spaces - so
+	//a silly vertex count can be caught before allocating for it
+	if (!validHeader || (unsigned long long)numVertices * 6 > (unsigned long long)bytesRead + 1) {
+		std::cout << "LoadMeshFile: " << filename << " has a bad header" << std::endl;
+		delete[] text;
+		return NULL;
+	}
+
+	Mesh *m = new Mesh();
+	m->type				= PRIMITIVE_TRIANGLES;
+	m->numVertices		= numVertices;
+	m->vertices			= new Vector4[m->numVertices];
+	m->textureCoords	= new Vector2[m->numVertices];
+	m->colours			= new Colour[m->numVertices];
+
+	bool valid = true;
+
+	for (uint i = 0; i < m->numVertices && valid; ++i) {
+		valid = tokens.ReadFloat(m->vertices[i].x) && 
+				tokens.ReadFloat(m->vertices[i].y) &&
+				tokens.ReadFloat(m->vertices[i].z);
+	}
+	for (uint i = 0; i < m->numVertices && valid && hasColour; ++i) {
+		valid = tokens.ReadColourChannel(m->colours[i].r) && 
+				tokens.ReadColourChannel(m->colours[i].g) &&
+				tokens.ReadColourChannel(m->colours[i].b) && 
+				tokens.ReadColourChannel(m->colours[i].a);
+	}
+	for (uint i = 0; i < m->numVertices && valid && hasTex; ++i) {
+		valid = tokens.ReadFloat(m->textureCoords[i].x) && 
+				tokens.ReadFloat(m->textureCoords[i].y);
+	}
+	delete[] text;
+
+	if (!valid) {
+		std::cout << "LoadMeshFile: " << filename << " ends early, or has a bad number in it" << std::endl;
+		delete m;
+		return NULL;
+	}
+
+	double seconds		= std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+	double megabytes	= fileSize / (1024.0 * 1024.0);
+
+	std::cout << "Loaded " << filename << ": " << numVertices << " vertices, " << megabytes << "MB parsed at " 
+		<< (seconds > 0.0 ? megabytes / seconds : 0.0) << "MB/s" << std::endl;
+
+	m->CalculateBounds();
+	//The mesh files are plain lists of triangles, so corners are repeated
+	m->WeldVertices();
+
+	return m;
+}
+
+/*
+The sphere is centred on the middle of the box, which isn't the tightest
+sphere possible, but is cheap to work out and good enough for culling.
+*/
+void Mesh::CalculateBounds() {
+	if (numVertices == 0) {
+		boundsMin		= Vector3();
+		boundsMax		= Vector3();
+		boundsCentre	= Vector3();
+		boundsRadius	= 0.0f;
+		return;
+	}
+
+	boundsMin = GetVertex(0).ToVector3();
+	boundsMax = GetVertex(0).ToVector3();
+
+	for (uint i = 1; i < numVertices; ++i) {
+		Vector4 v = GetVertex(i);
+
+		boundsMin.x = min(boundsMin.x, v.x);
+		boundsMin.y = min(boundsMin.y, v.y);
+		boundsMin.z = min(boundsMin.z, v.z);
+
+		boundsMax.x = max(boundsMax.x, v.x);
+		boundsMax.y = max(boundsMax.y, v.y);
+		boundsMax.z = max(boundsMax.z, v.z);
+	}
+
+	boundsCentre = (boundsMin + boundsMax) * 0.5f;
+
+	float radiusSquared = 0.0f;
+	for (uint i = 0; i < numVertices; ++i) {
+		radiusSquared = max(radiusSquared, (GetVertex(i).ToVector3() - boundsCentre).LengthSquared());
+	}
+	boundsRadius = sqrt(radiusSquared);
+}
+
+size_t Mesh::GetMemorySize() const {
+	size_t bytes = 0;
+	if (vertices) {
+		bytes += numVertices * sizeof(Vector4);
+	}
+	if (positionStreams[0]) {
+		bytes += GetStreamLength(numVertices) * 4 * sizeof(float);
+	}
+	if (colours) {
+		bytes += numVertices * sizeof(Colour);
+	}
+	if (textureCoords) {
+		bytes += numVertices * sizeof(Vector2);
+	}
+	bytes += numIndices * (indexType == INDEX_16 ? sizeof(unsigned short) : sizeof(uint));
+	return bytes;
+}
+
+uint Mesh::GetStreamLength(uint vertexCount) {
+	uint streamLength = (vertexCount + VERTEX_STREAM_PADDING - 1) / VERTEX_STREAM_PADDING * VERTEX_STREAM_PADDING;
+	return max(streamLength, VERTEX_STREAM_PADDING);
+}
+
+void Mesh::ConvertToSoA() {
+	if (layout == VERTEX_SOA) {
+		return;
+	}
+	TakeOwnership();
+
+	uint streamLength = GetStreamLength(numVertices);
+
+	float* streams = (float*)AlignedAlloc(streamLength * 4 * sizeof(float), 64);
+
+	for (int c = 0; c < 4; ++c) {
+		positionStreams[c] = streams + (c * streamLength);
+	}
+
+	for (uint i = 0; i < numVertices; ++i) {
+		positionStreams[0][i] = vertices[i].x;
+		positionStreams[1][i] = vertices[i].y;
+		positionStreams[2][i] = vertices[i].z;
+		positionStreams[3][i] = vertices[i].w;
+	}
+	//The padding is never drawn, but is set to something harmless anyway
+	for (uint i = numVertices; i < streamLength; ++i) {
+		positionStreams[0][i] = 0.0f;
+		positionStreams[1][i] = 0.0f;
+		positionStreams[2][i] = 0.0f;
+		positionStreams[3][i] = 1.0f;
+	}
+
+	delete[] vertices;
+	vertices	= NULL;
+	layout		= VERTEX_SOA;
+}
+
+void Mesh::SetIndices(const uint* newIndices, uint count) {
+	TakeOwnership();
+
+	delete[] indices16;
+	delete[] indices32;
+	indices16	= NULL;
+	indices32	= NULL;
+	numIndices	= count;
+
+	if (count == 0) {
+		indexType = INDEX_NONE;
 	}
-	if (hasColour) {
-		for (int i = 0; i < m->numVertices; ++i) {
-		 f >> m->colours[i].r; f >> m->colours[i].g;
-			f >> m->colours[i].b; f >> m->colours[i].a;
-			
+	else if (numVertices <= 65536) {
+		indexType = INDEX_16;
+		indices16 = new unsigned short[count];
+		for (uint i = 0; i < count; ++i) {
+			indices16[i] = (unsigned short)newIndices[i];
 		}
-		
 	}
+	else {
+		indexType = INDEX_32;
+		indices32 = new uint[count];
+		memcpy(indices32, newIndices, count * sizeof(uint));
+	}
+}
+
+//Everything that makes a vertex different from another. It's all 4 byte 
+//values, so there's no padding, and two keys can be compared as raw bytes.
+struct WeldKey {
+	Vector4 position;
+	Colour	colour;
+	Vector2 texCoord;
+};
+
+static inline uint HashWeldKey(const WeldKey &k) {
+	const uint* words = (const uint*)&k;
+	uint hash = 2166136261u;
+	for (size_t i = 0; i < sizeof(WeldKey) / sizeof(uint); ++i) {
+		hash = (hash ^ words[i]) * 0x85EBCA6Bu;
+		hash ^= hash >> 13;
+	}
+	return hash;
+}
+
+/*
+Vertices are compared bit for bit, so it's only exact duplicates that get
+merged - positions that are merely very close together are left alone, as
+are 0.0 and -0.0. The first copy of each vertex is kept, so the order of 
+the unique vertices is the order they first turn up in.
+*/
+void Mesh::WeldVertices() {
+	if (type != PRIMITIVE_TRIANGLES || numVertices == 0) {
+		return;
+	}
+	TakeOwnership();
+	uint count = (indexType == INDEX_NONE) ? numVertices : numIndices;
+
+	//An open addressed table, at most half full, of indices into uniqueKeys
+	uint tableSize = 16;
+	while (tableSize < numVertices * 2) {
+		tableSize *= 2;
+	}
+	vector<uint>	table(tableSize, ~0u);
+	vector<WeldKey>	uniqueKeys;
+	vector<uint>	newIndices(count);
+	vector<uint>	firstUse;	//Old vertex each new one was copied from
+	uniqueKeys.reserve(numVertices);
+	firstUse.reserve(numVertices);
+
+	for (uint i = 0; i < count; ++i) {
+		uint vertex = (indexType == INDEX_NONE) ? i : GetIndex(i);
+
+		WeldKey key;
+		memset((void*)&key, 0, sizeof(WeldKey));
+		key.position = GetVertex(vertex);
+		if (colours) {
+			key.colour = colours[vertex];
+		}
+		if (textureCoords) {
+			key.texCoord = textureCoords[vertex];
+		}
+
+		uint slot = HashWeldKey(key) & (tableSize - 1);
+		while (table[slot] != ~0u && memcmp(&uniqueKeys[table[slot]], &key, sizeof(WeldKey)) != 0) {
+			slot = (slot + 1) & (tableSize - 1);
+		}
+		if (table[slot] == ~0u) {
+			table[slot] = (uint)uniqueKeys.size();
+			uniqueKeys.push_back(key);
+			firstUse.push_back(vertex);
+		}
+		newIndices[i] = table[slot];
+	}
+
+	uint		newCount		= (uint)firstUse.size();
+	Vector4*	newVertices		= new Vector4[newCount];
+	Colour*		newColours		= colours		? new Colour[newCount]	: NULL;
+	Vector2*	newTexCoords	= textureCoords ? new Vector2[newCount]	: NULL;
+
+	for (uint i = 0; i < newCount; ++i) {
+		newVertices[i] = GetVertex(firstUse[i]);
+		if (newColours) {
+			newColours[i] = colours[firstUse[i]];
+		}
+		if (newTexCoords) {
+			newTexCoords[i] = textureCoords[firstUse[i]];
+		}
+	}
+
+	bool wasSoA = (layout == VERTEX_SOA);
+
+	delete[] vertices;
+	delete[] colours;
+	delete[] textureCoords;
+	AlignedFree(positionStreams[0]);
+	for (int i = 0; i < 4; ++i) {
+		positionStreams[i] = NULL;
+	}
+
+	layout			= VERTEX_AOS;
+	vertices		= newVertices;
+	colours			= newColours;
+	textureCoords	= newTexCoords;
+	numVertices		= newCount;
+
+	SetIndices(&newIndices[0], count);
+
+	if (wasSoA) {
+		ConvertToSoA();
+	}
+}
+
+template <class T> static T* CopyArray(const T* in, uint count) {
+	if (!in) {
+		return NULL;
+	}
+	T* out = new T[count];
+	memcpy((void*)out, in, count * sizeof(T));
+	return out;
+}
+
+void Mesh::TakeOwnership() {
+	if (!mappedFile) {
+		return;
+	}
+	vertices		= CopyArray(vertices, numVertices);
+	colours			= CopyArray(colours, numVertices);
+	textureCoords	= CopyArray(textureCoords, numVertices);
+	indices16		= CopyArray(indices16, numIndices);
+	indices32		= CopyArray(indices32, numIndices);
+
+	if (positionStreams[0]) {
+		uint	streamLength	= GetStreamLength(numVertices);
+		float*	streams			= (float*)AlignedAlloc(streamLength * 4 * sizeof(float), 64);
+
+		memcpy(streams, positionStreams[0], streamLength * 4 * sizeof(float));
+		for (int c = 0; c < 4; ++c) {
+			positionStreams[c] = streams + (c * streamLength);
+		}
+	}
+
+	delete mappedFile;
+	mappedFile = NULL;
+}
+
+/*
+Binary meshes are a fixed size header, followed by each of the mesh's arrays
+exactly as they're laid out in memory, so they can be pointed at directly 
+once the file is mapped. Every section starts on a multiple of 64 bytes from
+the start of the file - mappings always start on a page boundary, so the
+sections end up just as aligned as AlignedAlloc would make them. Everything
+is stored little endian, as that's all this ever runs on.
+
+The sections, each only there if the mesh has that array, are:
+	Vertices		numVertices Vector4s, or for VERTEX_SOA meshes 4 padded 
+					streams of GetStreamLength(numVertices) floats each
+	Colours			numVertices Colours
+	TexCoords		numVertices Vector2s
+	Indices			numIndices unsigned shorts or uints, from indexType
+*/
+static const char				BINARY_MESH_MAGIC[4]	= {'S', 'R', 'M', 'B'};
+static const uint				BINARY_MESH_VERSION		= 1;
+static const unsigned long long	BINARY_MESH_ALIGNMENT	= 64;
+
+struct BinaryMeshHeader {
+	char				magic[4];
+	uint				version;
+	uint				type;			//PrimitiveType
+	uint				layout;			//VertexLayout
+	uint				indexType;		//IndexType
+	uint				numVertices;
+	uint				numIndices;
+	uint				reserved;
+	unsigned long long	vertexOffset;	//Byte offsets of each section, or
+	unsigned long long	colourOffset;	//0 if the mesh doesn't have it
+	unsigned long long	texCoordOffset;
+	unsigned long long	indexOffset;
+	float				boundsMin[3];
+	float				boundsMax[3];
+	float				boundsCentre[3];
+	float				boundsRadius;
+};
+
+//Checks a section lies entirely inside of the file, and is properly aligned
+static bool BinaryMeshSectionValid(unsigned long long offset, unsigned long long bytes, size_t fileSize) {
+	if (offset < sizeof(BinaryMeshHeader) || offset % BINARY_MESH_ALIGNMENT != 0) {
+		return false;
+	}
+	return offset <= fileSize && bytes <= fileSize - offset;
+}
+
+Mesh* Mesh::LoadBinaryMeshFile(const string &filename) {
+	MappedFile* file = new MappedFile();
+
+	if (!file->Open(filename) || file->GetSize() < sizeof(BinaryMeshHeader)) {
+		delete file;
+		return NULL;
+	}
+	const unsigned char*	data	= file->GetData();
+	size_t					size	= file->GetSize();
+
+	BinaryMeshHeader header;
+	memcpy(&header, data, sizeof(BinaryMeshHeader));
+
+	//Same as GetStreamLength, but in 64 bits - so a vertex count right at the 
+	//top of a uint can't round up to a length of 0
+	unsigned long long streamLength = ((unsigned long long)header.numVertices + VERTEX_STREAM_PADDING - 1) / VERTEX_STREAM_PADDING * VERTEX_STREAM_PADDING;
+	streamLength = max(streamLength, (unsigned long long)VERTEX_STREAM_PADDING);
+
+	unsigned long long vertexBytes = (header.layout == VERTEX_SOA) ?
+		streamLength * 4 * sizeof(float) :
+		(unsigned long long)header.numVertices * sizeof(Vector4);
+	unsigned long long indexBytes = (unsigned long long)header.numIndices *
+		(header.indexType == INDEX_16 ? sizeof(unsigned short) : sizeof(uint));
+
+	bool valid = memcmp(header.magic, BINARY_MESH_MAGIC, 4) == 0 &&
+		header.version		== BINARY_MESH_VERSION		&&
+		header.type			<= PRIMITIVE_LINE_LOOPS		&&
+		header.layout		<= VERTEX_SOA				&&
+		header.indexType	<= INDEX_32					&&
+		(header.indexType == INDEX_NONE) == (header.numIndices == 0) &&
+		streamLength		<= UINT_MAX					&&
+		BinaryMeshSectionValid(header.vertexOffset, vertexBytes, size);
+
+	if (valid && header.colourOffset) {
+		valid = BinaryMeshSectionValid(header.colourOffset, (unsigned long long)header.numVertices * sizeof(Colour), size);
+	}
+	if (valid && header.texCoordOffset) {
+		valid = BinaryMeshSectionValid(header.texCoordOffset, (unsigned long long)header.numVertices * sizeof(Vector2), size);
+	}
+	if (valid && header.indexType != INDEX_NONE) {
+		valid = BinaryMeshSectionValid(header.indexOffset, indexBytes, size);
+	}
+	//The rasteriser reads both of these for every triangle, and the colours
+	//for every line
+	if (valid && header.type == PRIMITIVE_TRIANGLES) {
+		valid = header.colourOffset && header.texCoordOffset;
+	}
+	if (valid && (header.type == PRIMITIVE_LINES || header.type == PRIMITIVE_LINE_LOOPS)) {
+		valid = header.colourOffset != 0;
+	}
+	if (!valid) {
+		delete file;
+		return NULL;
+	}
+
+	Mesh* m = new Mesh();
+	m->type				= (PrimitiveType)header.type;
+	m->numVertices		= header.numVertices;
+	m->layout			= (VertexLayout)header.layout;
+	m->indexType		= (IndexType)header.indexType;
+	m->numIndices		= header.numIndices;
+	m->mappedFile		= file;
+
+	unsigned char* base = (unsigned char*)data;
+
+	if (m->layout == VERTEX_SOA) {
+		uint streamLength = GetStreamLength(m->numVertices);
+		for (int c = 0; c < 4; ++c) {
+			m->positionStreams[c] = (float*)(base + header.vertexOffset) + (c * streamLength);
+		}
+	}
+	else {
+		m->vertices = (Vector4*)(base + header.vertexOffset);
+	}
+	if (header.colourOffset) {
+		m->colours = (Colour*)(base + header.colourOffset);
+	}
+	if (header.texCoordOffset) {
+		m->textureCoords = (Vector2*)(base + header.texCoordOffset);
+	}
+	if (m->indexType == INDEX_16) {
+		m->indices16 = (unsigned short*)(base + header.indexOffset);
+	}
+	else if (m->indexType == INDEX_32) {
+		m->indices32 = (uint*)(base + header.indexOffset);
+	}
+
+	//A bad index would have the rasteriser reading off the end of the vertices,
+	//so they're the one thing that does get checked
+	for (uint i = 0; i < m->numIndices; ++i) {
+		if (m->GetIndex(i) >= m->numVertices) {
+			delete m;
+			return NULL;
+		}
+	}
+
+	m->boundsMin	= Vector3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+	m->boundsMax	= Vector3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+	m->boundsCentre = Vector3(header.boundsCentre[0], header.boundsCentre[1], header.boundsCentre[2]);
+	m->boundsRadius = header.boundsRadius;
+
 	return m;
-	
-}
\ No newline at end of file
+}
+
+//Writes out bytes, then pads the file with zeros up to the next section
+static bool WriteBinaryMeshSection(FILE* file, const void* bytes, size_t count, unsigned long long &offset) {
+	static const unsigned char padding[BINARY_MESH_ALIGNMENT] = {0};
+
+	if (fwrite(bytes, 1, count, file) != count) {
+		return false;
+	}
+	offset += count;
+
+	size_t padBytes = (size_t)((BINARY_MESH_ALIGNMENT - (offset % BINARY_MESH_ALIGNMENT)) % BINARY_MESH_ALIGNMENT);
+	if (fwrite(padding, 1, padBytes, file) != padBytes) {
+		return false;
+	}
+	offset += padBytes;
+	return true;
+}
+
+bool Mesh::SaveBinaryMeshFile(const string &filename) const {
+	size_t vertexBytes	= (layout == VERTEX_SOA) ?
+		GetStreamLength(numVertices) * 4 * sizeof(float) : numVertices * sizeof(Vector4);
+	size_t indexBytes	= numIndices * (indexType == INDEX_16 ? sizeof(unsigned short) : sizeof(uint));
+
+	BinaryMeshHeader header;
+	memset(&header, 0, sizeof(BinaryMeshHeader));
+	memcpy(header.magic, BINARY_MESH_MAGIC, 4);
+
+	header.version		= BINARY_MESH_VERSION;
+	header.type			= type;
+	header.layout		= layout;
+	header.indexType	= indexType;
+	header.numVertices	= numVertices;
+	header.numIndices	= numIndices;
+
+	header.boundsMin[0]		= boundsMin.x;		header.boundsMin[1]		= boundsMin.y;		header.boundsMin[2]		= boundsMin.z;
+	header.boundsMax[0]		= boundsMax.x;		header.boundsMax[1]		= boundsMax.y;		header.boundsMax[2]		= boundsMax.z;
+	header.boundsCentre[0]	= boundsCentre.x;	header.boundsCentre[1]	= boundsCentre.y;	header.boundsCentre[2]	= boundsCentre.z;
+	header.boundsRadius		= boundsRadius;
+
+	//Work out where everything will go before writing anything
+	unsigned long long offset = (sizeof(BinaryMeshHeader) + BINARY_MESH_ALIGNMENT - 1) / BINARY_MESH_ALIGNMENT * BINARY_MESH_ALIGNMENT;
+
+	header.vertexOffset = offset;
+	offset += (vertexBytes + BINARY_MESH_ALIGNMENT - 1) / BINARY_MESH_ALIGNMENT * BINARY_MESH_ALIGNMENT;
+	if (colours) {
+		header.colourOffset = offset;
+		offset += (numVertices * sizeof(Colour) + BINARY_MESH_ALIGNMENT - 1) / BINARY_MESH_ALIGNMENT * BINARY_MESH_ALIGNMENT;
+	}
+	if (textureCoords) {
+		header.texCoordOffset = offset;
+		offset += (numVertices * sizeof(Vector2) + BINARY_MESH_ALIGNMENT - 1) / BINARY_MESH_ALIGNMENT * BINARY_MESH_ALIGNMENT;
+	}
+	if (indexType != INDEX_NONE) {
+		header.indexOffset = offset;
+	}
+
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+
+	offset = 0;
+	const void* vertexData	= (layout == VERTEX_SOA) ? (const void*)positionStreams[0] : (const void*)vertices;
+	const void* indexData	= (indexType == INDEX_16) ? (const void*)indices16 : (const void*)indices32;
+
+	bool written = WriteBinaryMeshSection(file, &header, sizeof(BinaryMeshHeader), offset) &&
+		WriteBinaryMeshSection(file, vertexData, vertexBytes, offset) &&
+		(!colours		|| WriteBinaryMeshSection(file, colours, numVertices * sizeof(Colour), offset)) &&
+		(!textureCoords || WriteBinaryMeshSection(file, textureCoords, numVertices * sizeof(Vector2), offset)) &&
+		(indexType == INDEX_NONE || WriteBinaryMeshSection(file, indexData, indexBytes, offset));
+
+	return (fclose(file) == 0) && written;
+}
+
+bool Mesh::ConvertMeshFile(const string &asciiFile, const string &binaryFile) {
+	Mesh	loader;
+	Mesh*	m = loader.LoadMeshFile(asciiFile);
+
+	if (!m) {
+		return false;
+	}
+	bool saved = m->SaveBinaryMeshFile(binaryFile);
+	delete m;
+	return saved;
+}
@@ -19,6 +19,7 @@ _-_-_-_-_-_-_-""  ""
 #include "Vector3.h"
 #include "Vector2.h"
 #include "Common.h"
+#include "MappedFile.h"
 
 #include <string>
 #include <fstream>
@@ -33,6 +34,31 @@ enum PrimitiveType {
 	PRIMITIVE_LINE_LOOPS
 };
 
+//Which triangles a RenderObject has thrown away before rasterisation. 
+//Triangles that appear counter clockwise on screen are front facing. 
+enum CullMode {
+	CULL_NONE,
+	CULL_FRONT,
+	CULL_BACK
+};
+
+//How a mesh's vertex positions are laid out in memory
+enum VertexLayout {
+	VERTEX_AOS,	//An array of Vector4s, in 'vertices'
+	VERTEX_SOA	//Separate x, y, z and w arrays, in 'positionStreams'
+};
+
+//Size of each entry in a mesh's index buffer, if it has one
+enum IndexType {
+	INDEX_NONE,	//Vertices are used in order, each only once
+	INDEX_16,
+	INDEX_32
+};
+
+//The position streams are padded out to a multiple of this many floats, so
+//every stream starts on a 32 byte boundary, and can be read 8 at a time
+static const uint VERTEX_STREAM_PADDING = 8;
+
 class Mesh	{
 	friend class SoftwareRasteriser;
 public:
@@ -47,13 +73,96 @@ public:
 	static Mesh* GenerateStars();
 	static Mesh * GenerateShapes(const Vector3 &A1, const Vector3 &B1, const Vector3 &C1, const Vector3 &D1, const Vector3 &E1, const Vector3 &G1);
 
+	//Loads a mesh saved by SaveBinaryMeshFile. The file is mapped into memory
+	//and used where it is, so nothing is parsed or copied - returns NULL if 
+	//the file is missing, or isn't a valid binary mesh.
+	static Mesh*	LoadBinaryMeshFile(const string &filename);
+	bool			SaveBinaryMeshFile(const string &filename) const;
+
+	//Loads an .asciimesh file, and writes it back out as a binary mesh
+	static bool		ConvertMeshFile(const string &asciiFile, const string &binaryFile);
+
+	//True if the mesh's data still lives in a mapped binary mesh file. 
+	//Changing the mesh in any way takes a copy of it first.
+	bool			IsMapped() const { return mappedFile != NULL;}
+
+	uint			GetNumVertices() const { return numVertices;}
+
+	//Bytes taken up by the vertex data and indices - including mapped ones
+	size_t			GetMemorySize() const;
+
+	//Moves the positions out of 'vertices' into separate, aligned x, y, z and
+	//w streams, so they can be transformed with full width SIMD loads, and no
+	//shuffling. The colours and texture coordinates are already packed arrays
+	//of their own, so they stay as they are.
+	void			ConvertToSoA();
+
+	VertexLayout	GetVertexLayout() const { return layout;}
+
+	//Works with either layout, but slower than reading the arrays directly!
+	Vector4			GetVertex(uint i) const {
+		if (layout == VERTEX_SOA) {
+			return Vector4(positionStreams[0][i], positionStreams[1][i], positionStreams[2][i], positionStreams[3][i]);
+		}
+		return vertices[i];
+	}
+
+	//0 for x, through to 3 for w. NULL unless the mesh is VERTEX_SOA.
+	const float*	GetPositionStream(uint component) const { return positionStreams[component];}
+
+	//Triangle meshes can be drawn through an index buffer, so that vertices 
+	//shared between triangles only get transformed once per draw. Takes a 
+	//copy of the indices, stored as 16 bit if there are few enough vertices.
+	void			SetIndices(const uint* newIndices, uint count);
+
+	//Merges together vertices with exactly the same position, colour and
+	//texture coordinates, and builds an index buffer to draw the mesh with.
+	void			WeldVertices();
+
+	IndexType		GetIndexType()	const { return indexType;}
+	uint			GetNumIndices()	const { return numIndices;}
+
+	inline uint		GetIndex(uint i) const {
+		return (indexType == INDEX_16) ? indices16[i] : indices32[i];
+	}
+
+	//Local space axis aligned bounding box, and bounding sphere, of the mesh's 
+	//vertices. These are worked out once, when the mesh is created.
+	const Vector3&	GetBoundsMin()		const { return boundsMin;}
+	const Vector3&	GetBoundsMax()		const { return boundsMax;}
+	const Vector3&	GetBoundsCentre()	const { return boundsCentre;}
+	float			GetBoundsRadius()	const { return boundsRadius;}
+
 protected:
+	void			CalculateBounds();
+
+	//Copies everything out of the mapped file into arrays of the mesh's own
+	void			TakeOwnership();
+
+	//How many floats each position stream holds, once padded
+	static uint		GetStreamLength(uint vertexCount);
+
 	PrimitiveType	type;
 
 	uint			numVertices;
 
+	VertexLayout	layout;
+
 	Vector4*		vertices;
+	float*			positionStreams[4];	//All 4 share one aligned allocation
 	Colour*			colours;
 	Vector2*		textureCoords;	
+
+	IndexType		indexType;
+	uint			numIndices;
+	unsigned short*	indices16;
+	uint*			indices32;
+
+	MappedFile*		mappedFile;		//If not NULL, all of the above point into it
+
+	Vector3			boundsMin;
+	Vector3			boundsMax;
+	Vector3			boundsCentre;
+	float			boundsRadius;
 };
 
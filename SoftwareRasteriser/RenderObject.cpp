@@ -4,6 +4,8 @@
 RenderObject::RenderObject(void)	{
 	texture = NULL;
 	mesh	= NULL;
+
+	cullMode = CULL_NONE;
 }
 
 
@@ -36,5 +36,7 @@ public:
 
 	Texture*	texture;
 	Mesh*		mesh;
+
+	CullMode	cullMode;
 };
 
@@ -0,0 +1,58 @@
+#include "RenderTarget.h"
+
+RenderTarget::RenderTarget(uint width, uint height) {
+	colourBuffers[0]	= NULL;
+	colourBuffers[1]	= NULL;
+	depthBuffer			= NULL;
+	ownsColourBuffers	= false;
+	bufferGeneration	= 0;
+
+	AllocateBuffers(width, height);
+}
+
+RenderTarget::~RenderTarget(void) {
+	FreeBuffers();
+}
+
+void RenderTarget::AllocateBuffers(uint width, uint height) {
+	FreeBuffers();
+
+	screenWidth		= width;
+	screenHeight	= height;
+
+	//Never hand out NULL, even for a window that's been minimised down to nothing
+	size_t pixels = max((size_t)screenWidth * screenHeight, (size_t)1);
+
+	for (int i = 0; i < 2; ++i) {
+		colourBuffers[i] = (Colour*)AlignedAlloc(pixels * sizeof(Colour), RENDER_TARGET_ALIGNMENT);
+	}
+	depthBuffer			= (unsigned short*)AlignedAlloc(pixels * sizeof(unsigned short), RENDER_TARGET_ALIGNMENT);
+	ownsColourBuffers	= true;
+
+	++bufferGeneration;
+}
+
+void RenderTarget::UseExternalColourBuffers(Colour* front, Colour* back) {
+	if (ownsColourBuffers) {
+		AlignedFree(colourBuffers[0]);
+		AlignedFree(colourBuffers[1]);
+	}
+	colourBuffers[0]	= front;
+	colourBuffers[1]	= back;
+	ownsColourBuffers	= false;
+
+	++bufferGeneration;
+}
+
+void RenderTarget::FreeBuffers() {
+	if (ownsColourBuffers) {
+		AlignedFree(colourBuffers[0]);
+		AlignedFree(colourBuffers[1]);
+	}
+	AlignedFree(depthBuffer);
+
+	colourBuffers[0]	= NULL;
+	colourBuffers[1]	= NULL;
+	depthBuffer			= NULL;
+	ownsColourBuffers	= false;
+}
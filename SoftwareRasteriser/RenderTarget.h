@@ -0,0 +1,61 @@
+/******************************************************************************
+Class:RenderTarget
+Implements:
+Description:The memory a SoftwareRasteriser draws into - a pair of colour 
+buffers to flip between, and a depth buffer - along with somewhere for the
+finished frames to go. None of this knows anything about the OS: the Win32
+Window is just one kind of RenderTarget, which puts its frames on screen, while
+a HeadlessTarget hands them over to your own code instead.
+
+The buffers are allocated on cache line boundaries, so the rasteriser's SIMD
+kernels never have to straddle two lines with a load at the start of a row.
+Colour buffer rows go bottom to top, the same as a Windows DIB.
+
+-_-_-_-_-_-_-_,------,   
+_-_-_-_-_-_-_-|   /\_/\   NYANYANYAN
+-_-_-_-_-_-_-~|__( ^ .^) /
+_-_-_-_-_-_-_-""  ""   
+
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "Common.h"
+#include "Colour.h"
+
+//Alignment of the colour and depth buffers, in bytes
+static const size_t RENDER_TARGET_ALIGNMENT = 64;
+
+class RenderTarget	{
+public:
+	RenderTarget(uint width, uint height);
+	virtual ~RenderTarget(void);
+
+	uint	GetWidth()	const { return screenWidth;}
+	uint	GetHeight() const { return screenHeight;}
+
+	Colour*			GetColourBuffer(int index)	{ return colourBuffers[index];}
+	unsigned short*	GetDepthBuffer()			{ return depthBuffer;}
+
+	//Goes up by one every time the buffers are reallocated - anything holding
+	//onto the buffer pointers can compare this to see if they've gone stale.
+	uint	GetBufferGeneration() const { return bufferGeneration;}
+
+	//Called with one of the colour buffers once a frame has been finished
+	virtual void PresentBuffer(Colour*buffer) = 0;
+
+protected:
+	//Throws away the old buffers, and allocates new ones of the given size
+	void	AllocateBuffers(uint width, uint height);
+	//Draws into memory the target owns some other way, instead of its own 
+	//colour buffers. They're expected to be screenWidth * screenHeight.
+	void	UseExternalColourBuffers(Colour* front, Colour* back);
+	void	FreeBuffers();
+
+	uint	screenWidth;
+	uint	screenHeight;
+
+	Colour*			colourBuffers[2];
+	unsigned short*	depthBuffer;
+	bool			ownsColourBuffers;
+	uint			bufferGeneration;
+};
@@ -0,0 +1,202 @@
+#include "ResourceCache.h"
+#include "Texture.h"
+
+ResourceCache::ResourceCache(size_t memoryBudget) {
+	this->memoryBudget	= memoryBudget;
+	memoryUsed			= 0;
+}
+
+ResourceCache::~ResourceCache(void) {
+	for (std::map<string, CachedResource*>::iterator i = byKey.begin(); i != byKey.end(); ++i) {
+		DeleteResource(i->second);
+	}
+}
+
+//Meshes and textures are kept under different keys, so a file can't be
+//mistaken for the other type
+static string ResourceKey(ResourceType type, const string &name) {
+	return (type == RESOURCE_MESH ? "mesh:" : "texture:") + name;
+}
+
+Mesh* ResourceCache::GetMesh(const string &filename) {
+	return (Mesh*)Acquire(ResourceKey(RESOURCE_MESH, filename), RESOURCE_MESH, [&filename]() -> void* {
+		Mesh* m = Mesh::LoadBinaryMeshFile(filename);
+		if (!m) {
+			Mesh loader;
+			m = loader.LoadMeshFile(filename);
+		}
+		return m;
+	});
+}
+
+Texture* ResourceCache::GetTexture(const string &filename) {
+	return (Texture*)Acquire(ResourceKey(RESOURCE_TEXTURE, filename), RESOURCE_TEXTURE, [&filename]() -> void* {
+		Texture* t = Texture::LoadCompressedTexture(filename);
+		if (!t) {
+			t = Texture::TextureFromTGA(filename);
+		}
+		return t;
+	});
+}
+
+Mesh* ResourceCache::GetGeneratedMesh(const string &key, const std::function<Mesh*()> &generator) {
+	return (Mesh*)Acquire(ResourceKey(RESOURCE_MESH, "generated:" + key), RESOURCE_MESH, [&generator]() -> void* {
+		return generator();
+	});
+}
+
+Texture* ResourceCache::AddTexture(const string &filename, Texture* t) {
+	if (!t) {
+		return NULL;
+	}
+	Texture* cached = (Texture*)Acquire(ResourceKey(RESOURCE_TEXTURE, filename), RESOURCE_TEXTURE, [t]() -> void* {
+		return t;
+	});
+	if (cached != t) {
+		delete t;
+	}
+	return cached;
+}
+
+void* ResourceCache::Acquire(const string &key, ResourceType type, const std::function<void*()> &load) {
+	std::unique_lock<std::mutex> lock(cacheMutex);
+
+	std::map<string, CachedResource*>::iterator found = byKey.find(key);
+
+	if (found != byKey.end()) {
+		CachedResource* r = found->second;
+		if (r->references++ == 0) {
+			unused.erase(r->unusedPosition);
+		}
+		if (r->resource) {
+			return r->resource;
+		}
+		//Another thread is still loading it, so wait for that to finish. The
+		//reference taken above keeps the entry around even if the load fails
+		std::shared_future<void*> loaded = r->loaded;
+		lock.unlock();
+
+		void* resource = loaded.get();
+		if (!resource) {
+			lock.lock();
+			if (--r->references == 0) {
+				delete r;
+			}
+		}
+		return resource;
+	}
+
+	//Put an entry in for it before unlocking, so nobody else loads it too
+	std::promise<void*> loading;
+
+	CachedResource* r = new CachedResource();
+	r->key			= key;
+	r->type			= type;
+	r->resource		= NULL;
+	r->size			= 0;
+	r->references	= 1;
+	r->loaded		= loading.get_future().share();
+
+	byKey[key] = r;
+
+	lock.unlock();
+	void* resource = load();
+	size_t size = 0;
+	if (resource) {
+		size = (type == RESOURCE_MESH) ? 
+			((Mesh*)resource)->GetMemorySize() : ((Texture*)resource)->GetMemorySize();
+	}
+	lock.lock();
+
+	if (!resource) {
+		//Nothing is cached - anyone waiting on it gets NULL too
+		byKey.erase(key);
+		if (--r->references == 0) {
+			delete r;
+		}
+	}
+	else {
+		r->resource			= resource;
+		r->size				= size;
+		byPointer[resource]	= r;
+		memoryUsed			+= size;
+
+		//The new resource is in use, so can't go - but it may push others out
+		EvictUnused();
+	}
+	lock.unlock();
+
+	loading.set_value(resource);
+	return resource;
+}
+
+void ResourceCache::Release(Mesh* m) {
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	ReleaseResource(m);
+}
+
+void ResourceCache::Release(Texture* t) {
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	ReleaseResource(t);
+}
+
+void ResourceCache::ReleaseResource(void* resource) {
+	std::map<void*, CachedResource*>::iterator found = byPointer.find(resource);
+
+	if (found == byPointer.end() || found->second->references == 0) {
+		return;	//Not from this cache, or released too many times
+	}
+	CachedResource* r = found->second;
+
+	if (--r->references == 0) {
+		r->unusedPosition = unused.insert(unused.end(), r);
+		EvictUnused();
+	}
+}
+
+void ResourceCache::SetMemoryBudget(size_t bytes) {
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	memoryBudget = bytes;
+	EvictUnused();
+}
+
+size_t ResourceCache::GetMemoryBudget() const {
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	return memoryBudget;
+}
+
+size_t ResourceCache::GetMemoryUsed() const {
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	return memoryUsed;
+}
+
+uint ResourceCache::GetResourceCount() const {
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	return (uint)byKey.size();
+}
+
+void ResourceCache::EvictUnused() {
+	if (memoryBudget == 0) {
+		return;
+	}
+	while (memoryUsed > memoryBudget && !unused.empty()) {
+		CachedResource* r = unused.front();
+		unused.pop_front();
+
+		byKey.erase(r->key);
+		byPointer.erase(r->resource);
+		memoryUsed -= r->size;
+
+		DeleteResource(r);
+	}
+}
+
+void ResourceCache::DeleteResource(CachedResource* r) {
+	if (r->type == RESOURCE_MESH) {
+		delete (Mesh*)r->resource;
+	}
+	else {
+		delete (Texture*)r->resource;
+	}
+	delete r;
+}
@@ -0,0 +1,107 @@
+/******************************************************************************
+Class:ResourceCache
+Implements:
+Description:Makes sure each mesh and texture is only ever loaded (or generated)
+once, no matter how many objects use it. Resources are looked up by filename, 
+or for generated meshes, by a key describing how they were made, and each
+request for one hands back the same shared copy, with its reference count 
+bumped up. Releasing it again drops the count.
+
+Resources nobody is using any more aren't deleted straight away, as they may
+well be asked for again - they're only thrown out, least recently used first,
+once the cache goes over its memory budget. Resources still in use are never
+deleted, so a cache can go over budget if everything in it is needed.
+
+Everything left in the cache is deleted along with it, so anything from it 
+must have been finished with by then. All of the functions can be called
+from any thread. Loads happen with the cache unlocked, so different resources
+can load at once - threads asking for one that's already loading just wait 
+for it, rather than loading it again. That means a generator can use the 
+cache too, as long as it doesn't ask for the mesh it's generating!
+
+-_-_-_-_-_-_-_,------,   
+_-_-_-_-_-_-_-|   /\_/\   NYANYANYAN
+-_-_-_-_-_-_-~|__( ^ .^) /
+_-_-_-_-_-_-_-""  ""   
+
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "Mesh.h"
+
+#include <string>
+#include <list>
+#include <map>
+#include <mutex>
+#include <future>
+#include <functional>
+
+using std::string;
+
+class Texture;
+
+enum ResourceType {
+	RESOURCE_MESH,
+	RESOURCE_TEXTURE
+};
+
+struct CachedResource {
+	string			key;
+	ResourceType	type;
+	void*			resource;	//A Mesh* or a Texture*, depending on type - NULL while loading
+	size_t			size;		//Bytes of memory it's using
+	uint			references;	//Including threads waiting for it to load
+
+	std::shared_future<void*> loaded;	//Ready once loading has finished, whether it worked or not
+
+	//Where it is in the cache's list of unused resources, if references is 0
+	std::list<CachedResource*>::iterator unusedPosition;
+};
+
+class ResourceCache	{
+public:
+	//A budget of 0 means unused resources are kept around forever
+	ResourceCache(size_t memoryBudget = 0);
+	~ResourceCache(void);
+
+	//Each of these returns NULL if the resource can't be loaded - in which
+	//case nothing is cached, and there's nothing to release.
+	Mesh*		GetMesh(const string &filename);
+	Texture*	GetTexture(const string &filename);
+
+	//For meshes made in code. The key should cover everything that makes one
+	//generated mesh different from another, such as "line 0 0 0 1 1 1" - the
+	//generator is only called if there isn't a mesh with that key already.
+	Mesh*		GetGeneratedMesh(const string &key, const std::function<Mesh*()> &generator);
+
+	//Hands a texture that's already been loaded (by an AssetLoader, say) over
+	//to the cache. If there's one under that name already, t is deleted, and
+	//the cached one returned instead - either way, it needs releasing.
+	Texture*	AddTexture(const string &filename, Texture* t);
+
+	void		Release(Mesh* m);
+	void		Release(Texture* t);
+
+	void		SetMemoryBudget(size_t bytes);
+	size_t		GetMemoryBudget()	const;
+	size_t		GetMemoryUsed()		const;
+	uint		GetResourceCount()	const;
+
+protected:
+	//Locks the cache itself, but only for as long as it takes to find or add
+	//the resource - the load runs with the cache unlocked
+	void*		Acquire(const string &key, ResourceType type, const std::function<void*()> &load);
+	//All of these expect the cache to be locked already
+	void		ReleaseResource(void* resource);
+	void		EvictUnused();
+	void		DeleteResource(CachedResource* r);
+
+	std::map<string, CachedResource*>	byKey;
+	std::map<void*, CachedResource*>	byPointer;
+	std::list<CachedResource*>			unused;		//Least recently used at the front
+
+	size_t		memoryBudget;
+	size_t		memoryUsed;
+
+	mutable std::mutex	cacheMutex;	//Locked by the const getters too
+};
@@ -0,0 +1,279 @@
+#include "Scene.h"
+#include "SoftwareRasteriser.h"
+
+#include <algorithm>
+#include <cstring>
+
+Scene::Scene(void) {
+	builtArea		= 0.0f;
+	needsRebuild	= false;
+	drawnObjects	= 0;
+}
+
+Scene::~Scene(void) {
+	for (uint i = 0; i < objects.size(); ++i) {
+		delete objects[i];
+	}
+}
+
+void Scene::AddObject(RenderObject* o) {
+	if (!o) {
+		return;
+	}
+	objects.push_back(o);
+	objectMatrices.push_back(o->modelMatrix);
+	objectMins.push_back(Vector3());
+	objectMaxs.push_back(Vector3());
+
+	CalculateWorldBounds(objects.size() - 1);
+	needsRebuild = true;
+}
+
+void Scene::RemoveObject(RenderObject* o) {
+	for (uint i = 0; i < objects.size(); ++i) {
+		if (objects[i] == o) {
+			objects.erase(objects.begin() + i);
+			objectMatrices.erase(objectMatrices.begin() + i);
+			objectMins.erase(objectMins.begin() + i);
+			objectMaxs.erase(objectMaxs.begin() + i);
+			needsRebuild = true;
+			return;
+		}
+	}
+}
+
+/*
+Transforming all 8 corners of the local box would work, but each world axis of
+the new box is just the transformed centre, plus the local extents scaled by the
+absolute values of that row of the matrix - see 'Transforming Axis-Aligned
+Bounding Boxes', by Jim Arvo, in Graphics Gems.
+*/
+void Scene::CalculateWorldBounds(uint object) {
+	const Mesh*		mesh	= objects[object]->mesh;
+	const Matrix4&	m		= objectMatrices[object];
+
+	if (!mesh) {
+		objectMins[object] = m.GetPositionVector();
+		objectMaxs[object] = m.GetPositionVector();
+		return;
+	}
+
+	Vector3 centre	= (mesh->GetBoundsMax() + mesh->GetBoundsMin()) * 0.5f;
+	Vector3 extent	= (mesh->GetBoundsMax() - mesh->GetBoundsMin()) * 0.5f;
+
+	Vector3 worldCentre = m * centre;
+	Vector3 worldExtent(
+		fabs(m.values[0]) * extent.x + fabs(m.values[4]) * extent.y + fabs(m.values[8])  * extent.z,
+		fabs(m.values[1]) * extent.x + fabs(m.values[5]) * extent.y + fabs(m.values[9])  * extent.z,
+		fabs(m.values[2]) * extent.x + fabs(m.values[6]) * extent.y + fabs(m.values[10]) * extent.z);
+
+	objectMins[object] = worldCentre - worldExtent;
+	objectMaxs[object] = worldCentre + worldExtent;
+}
+
+float Scene::SurfaceArea(const Vector3 &boxMin, const Vector3 &boxMax) {
+	Vector3 d = boxMax - boxMin;
+	return 2.0f * ((d.x * d.y) + (d.y * d.z) + (d.z * d.x));
+}
+
+//Returns true if any of the objects have moved since the last call
+bool Scene::UpdateBounds() {
+	bool moved = false;
+
+	for (uint i = 0; i < objects.size(); ++i) {
+		if (memcmp(objectMatrices[i].values, objects[i]->modelMatrix.values, sizeof(float) * 16) != 0) {
+			objectMatrices[i] = objects[i]->modelMatrix;
+			CalculateWorldBounds(i);
+			moved = true;
+		}
+	}
+	return moved;
+}
+
+void Scene::Update() {
+	bool moved = UpdateBounds();
+
+	if (needsRebuild) {
+		BuildTree();
+	}
+	else if (moved) {
+		Refit();
+		if (!nodes.empty() && SurfaceArea(nodes[0].boundsMin, nodes[0].boundsMax) > builtArea * SCENE_REBUILD_RATIO) {
+			BuildTree();
+		}
+	}
+}
+
+void Scene::Rebuild() {
+	UpdateBounds();
+	BuildTree();
+}
+
+void Scene::BuildTree() {
+	nodes.clear();
+	needsRebuild = false;
+
+	if (objects.empty()) {
+		builtArea = 0.0f;
+		return;
+	}
+
+	//A binary tree with one object per leaf always has 2n-1 nodes
+	nodes.reserve(objects.size() * 2 - 1);
+
+	vector<int> indices(objects.size());
+	for (uint i = 0; i < objects.size(); ++i) {
+		indices[i] = i;
+	}
+	BuildNode(&indices[0], indices.size());
+
+	builtArea = SurfaceArea(nodes[0].boundsMin, nodes[0].boundsMax);
+}
+
+/*
+Top down build - the objects are split in half around the median of their
+centres, along the longest axis of the box around those centres. This always
+gives a balanced tree, so the recursion never gets deeper than log2(n).
+*/
+int Scene::BuildNode(int* indices, int count) {
+	int nodeIndex = nodes.size();
+	nodes.push_back(SceneNode());
+
+	Vector3 boundsMin = objectMins[indices[0]];
+	Vector3 boundsMax = objectMaxs[indices[0]];
+	Vector3 centreMin = (objectMins[indices[0]] + objectMaxs[indices[0]]) * 0.5f;
+	Vector3 centreMax = centreMin;
+
+	for (int i = 1; i < count; ++i) {
+		const Vector3 &oMin = objectMins[indices[i]];
+		const Vector3 &oMax = objectMaxs[indices[i]];
+		Vector3 centre = (oMin + oMax) * 0.5f;
+
+		boundsMin = Vector3(min(boundsMin.x, oMin.x), min(boundsMin.y, oMin.y), min(boundsMin.z, oMin.z));
+		boundsMax = Vector3(max(boundsMax.x, oMax.x), max(boundsMax.y, oMax.y), max(boundsMax.z, oMax.z));
+		centreMin = Vector3(min(centreMin.x, centre.x), min(centreMin.y, centre.y), min(centreMin.z, centre.z));
+		centreMax = Vector3(max(centreMax.x, centre.x), max(centreMax.y, centre.y), max(centreMax.z, centre.z));
+	}
+
+	nodes[nodeIndex].boundsMin	= boundsMin;
+	nodes[nodeIndex].boundsMax	= boundsMax;
+
+	if (count == 1) {
+		nodes[nodeIndex].left	= -1;
+		nodes[nodeIndex].right	= -1;
+		nodes[nodeIndex].object = indices[0];
+		return nodeIndex;
+	}
+
+	Vector3 spread = centreMax - centreMin;
+	int axis = 0;
+	if (spread.y > spread.x) {
+		axis = 1;
+	}
+	if (spread.z > (axis == 0 ? spread.x : spread.y)) {
+		axis = 2;
+	}
+
+	const vector<Vector3> &mins = objectMins;
+	const vector<Vector3> &maxs = objectMaxs;
+	int half = count / 2;
+
+	//Both bounds are summed rather than averaged - it's only used for ordering
+	std::nth_element(indices, indices + half, indices + count, [&](int a, int b) {
+		const float* aMin = &mins[a].x;
+		const float* aMax = &maxs[a].x;
+		const float* bMin = &mins[b].x;
+		const float* bMax = &maxs[b].x;
+		return (aMin[axis] + aMax[axis]) < (bMin[axis] + bMax[axis]);
+	});
+
+	//Children are pushed on after their parent, so the nodes vector can't be
+	//held onto by reference across these calls.
+	int left	= BuildNode(indices, half);
+	int right	= BuildNode(indices + half, count - half);
+
+	nodes[nodeIndex].left	= left;
+	nodes[nodeIndex].right	= right;
+	nodes[nodeIndex].object = -1;
+
+	return nodeIndex;
+}
+
+/*
+As every parent is stored before its children, walking backwards through the
+nodes always reaches the children first, so one pass fixes the whole tree.
+*/
+void Scene::Refit() {
+	for (int i = (int)nodes.size() - 1; i >= 0; --i) {
+		SceneNode &n = nodes[i];
+
+		if (n.left < 0) {
+			n.boundsMin = objectMins[n.object];
+			n.boundsMax = objectMaxs[n.object];
+			continue;
+		}
+
+		const SceneNode &l = nodes[n.left];
+		const SceneNode &r = nodes[n.right];
+
+		n.boundsMin = Vector3(min(l.boundsMin.x, r.boundsMin.x), min(l.boundsMin.y, r.boundsMin.y), min(l.boundsMin.z, r.boundsMin.z));
+		n.boundsMax = Vector3(max(l.boundsMax.x, r.boundsMax.x), max(l.boundsMax.y, r.boundsMax.y), max(l.boundsMax.z, r.boundsMax.z));
+	}
+}
+
+/*
+Each stack entry keeps the planes its node still has to be tested against -
+once a node is entirely inside a plane, so are all of its children, so a node
+entirely inside the frustum has its whole subtree drawn with no further tests.
+Of the two children, the one whose centre is nearest the camera is visited first.
+*/
+void Scene::Draw(SoftwareRasteriser &r) {
+	Update();
+
+	drawnObjects = 0;
+
+	if (nodes.empty()) {
+		return;
+	}
+
+	Frustum frustum(r.GetViewProjectionMatrix());
+	Vector3 cameraPos = Matrix4(r.GetViewMatrix()).Inverse().GetPositionVector();
+
+	traversalStack.clear();
+	traversalStack.push_back(0);
+	traversalStack.push_back(FRUSTUM_ALL_PLANES);
+
+	while (!traversalStack.empty()) {
+		int planeMask = traversalStack.back();
+		traversalStack.pop_back();
+		int nodeIndex = traversalStack.back();
+		traversalStack.pop_back();
+
+		const SceneNode &n = nodes[nodeIndex];
+
+		if (planeMask && frustum.ClassifyBox(n.boundsMin, n.boundsMax, planeMask) == FRUSTUM_OUTSIDE) {
+			continue;
+		}
+
+		if (n.left < 0) {
+			r.DrawObject(objects[n.object]);
+			++drawnObjects;
+			continue;
+		}
+
+		const SceneNode &l = nodes[n.left];
+		const SceneNode &rn = nodes[n.right];
+
+		float leftDist	= ((l.boundsMin + l.boundsMax) * 0.5f - cameraPos).LengthSquared();
+		float rightDist	= ((rn.boundsMin + rn.boundsMax) * 0.5f - cameraPos).LengthSquared();
+
+		//Stack is last in first out, so the far child goes on first
+		int nearChild	= leftDist <= rightDist ? n.left  : n.right;
+		int farChild	= leftDist <= rightDist ? n.right : n.left;
+
+		traversalStack.push_back(farChild);
+		traversalStack.push_back(planeMask);
+		traversalStack.push_back(nearChild);
+		traversalStack.push_back(planeMask);
+	}
+}
@@ -0,0 +1,101 @@
+/******************************************************************************
+Class:Scene
+Implements:
+Description:Owns a collection of RenderObjects, and keeps a bounding volume
+hierarchy of their world space bounds. Drawing the scene walks down the tree,
+throwing away whole branches that are outside of the view frustum, and visits
+what's left nearest first, so the depth buffer fills up with occluders as early
+as possible.
+
+The tree is only rebuilt when objects are added or removed - moving objects
+just refits the boxes of the nodes above them, which is far cheaper. If enough
+has moved that the refitted tree has got much looser than when it was built,
+it gets rebuilt anyway.
+
+-_-_-_-_-_-_-_,------,   
+_-_-_-_-_-_-_-|   /\_/\   NYANYANYAN
+-_-_-_-_-_-_-~|__( ^ .^) /
+_-_-_-_-_-_-_-""  ""   
+
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "RenderObject.h"
+#include "Frustum.h"
+#include "Common.h"
+
+#include <vector>
+
+using std::vector;
+
+class SoftwareRasteriser;
+
+struct SceneNode {
+	Vector3 boundsMin;
+	Vector3 boundsMax;
+
+	int		left;	//Child node indices, or -1 if this is a leaf
+	int		right;
+	int		object;	//Index into the scene's objects, for leaves
+};
+
+class Scene	{
+public:
+	Scene(void);
+	//Deletes every RenderObject still in the scene - but not their meshes or
+	//textures, which may well be shared between objects.
+	~Scene(void);
+
+	//The scene takes ownership of the object
+	void	AddObject(RenderObject* o);
+	//Takes the object back out of the scene - the caller owns it again.
+	void	RemoveObject(RenderObject* o);
+
+	const vector<RenderObject*>& GetObjects() const {
+		return objects;
+	}
+
+	//Picks up any objects whose model matrix has changed since the last update,
+	//and refits the tree around them. Draw calls this itself, so it only needs
+	//calling directly if you want the bounds without drawing.
+	void	Update();
+
+	//Builds the tree from scratch, around wherever the objects are right now.
+	//The order objects are drawn in then only depends on where they are, and
+	//not on how they got there - handy if frames need to be reproducible.
+	void	Rebuild();
+
+	//Draws every object that's inside the view frustum of r, nearest first
+	void	Draw(SoftwareRasteriser &r);
+
+	//How many objects were sent to the rasteriser by the last Draw
+	uint	GetDrawnObjectCount() const {
+		return drawnObjects;
+	}
+
+protected:
+	bool	UpdateBounds();
+	void	BuildTree();
+	int		BuildNode(int* indices, int count);
+	void	Refit();
+
+	void	CalculateWorldBounds(uint object);
+
+	static float SurfaceArea(const Vector3 &boxMin, const Vector3 &boxMax);
+
+	vector<RenderObject*>	objects;
+	vector<Matrix4>			objectMatrices;	//Model matrices the bounds were built from
+	vector<Vector3>			objectMins;		//World space bounds of each object
+	vector<Vector3>			objectMaxs;
+
+	vector<SceneNode>		nodes;			//Parents always come before their children
+	vector<int>				traversalStack;
+
+	float	builtArea;		//Surface area of the root when the tree was last built
+	bool	needsRebuild;
+	uint	drawnObjects;
+};
+
+//If refitting has grown the root this much bigger than when it was built, the
+//tree has probably got too loose to cull well, so is rebuilt from scratch
+static const float SCENE_REBUILD_RATIO = 2.0f;
@@ -1,95 +1,109 @@
 #include "SoftwareRasteriser.h"
+#include "CPUFeatures.h"
 #include <cmath>
+#include <cstring>
 #include <math.h>
-/*
-While less 'neat' than just doing a 'new', like in the tutorials, it's usually
-possible to render a bit quicker to use direct pointers to the drawing area
-that the OS gives you. For a bit of a speedup, you can uncomment the define below
-to switch to using this method.
-
-For those of you new to the preprocessor, here's a quick explanation:
-
-Preprocessor definitions like #define allow parts of a file to be selectively enabled
-or disabled at compile time. This is useful for hiding parts of the codebase on a
-per-platform basis: if you have support for linux and windows in your codebase, obviously
-the linux platform won't have the windows platform headers available, so compilation will
-fail. So instead you can hide away all the platform specific stuff:
-
-#if PLATFORM_WINDOWS
- DoSomeWindowsStuff();
-#elif PLATFORM_LINUX
- DoSomeLinuxStuff();
- #else
- #error Unsupported Platform Specified!
- #endif
-
- As in our usage, it also allows you to selectively compile in some different functionality
- without any 'run time' cost - if it's not enabled by the preprocessor, it won't make it to
- the compiler, so no assembly will be generated.
-
-Also, I've implemented the Resize method for you, in a manner that'll behave itself
-no matter which method you use. I kinda forgot to do that, so there was a chance you'd
-get exceptions if you resized to a bigger screen area. Sorry about that.
-*/
-//#define USE_OS_BUFFERS
 
-SoftwareRasteriser::SoftwareRasteriser(uint width, uint height)	: Window(width, height){
+SoftwareRasteriser::SoftwareRasteriser(RenderTarget &renderTarget, int numThreads)	: target(&renderTarget), threadPool(numThreads) {
 	currentTexture = NULL;
+	currentCullMode = CULL_NONE;
 	currentDrawBuffer = 0;
 
-#ifndef USE_OS_BUFFERS
-	//Hi! In the tutorials, it's mentioned that we need to form our front + back buffer like so:
-	for (int i = 0; i < 2; ++i) {
-		buffers[i] = new Colour[screenWidth * screenHeight];
-	}
-#else
-	//This works, but we can actually save a memcopy by rendering directly into the memory the 
-	//windowing system gives us, which I've added to the Window class as the 'bufferData' pointers
-	for (int i = 0; i < 2; ++i) {
-		buffers[i] = (Colour*)bufferData[i];
+	depthFunction	= DEPTH_LESS_EQUAL;
+	depthWrite		= true;
+	textureFilter	= FILTER_NEAREST;
+
+	rasteriserPrecision	= PRECISION_FLOAT;
+	rasteriserKernel	= KERNEL_SCALAR;
+	if (!SetRasteriserKernel(KERNEL_AVX2)) {
+		SetRasteriserKernel(KERNEL_SSE41);
 	}
-#endif
 
-	depthBuffer		=	new unsigned short[screenWidth * screenHeight];
+	hiZBuffer		=	NULL;
+	Resize();
+}
+
+SoftwareRasteriser::~SoftwareRasteriser(void)	{
+	delete[] hiZBuffer;
+}
+
+/*
+The colour and depth buffers belong to the render target, so this just picks
+up their new pointers and size, and rebuilds everything that depends on them.
+*/
+void SoftwareRasteriser::Resize() {
+	screenWidth			= target->GetWidth();
+	screenHeight		= target->GetHeight();
+	buffers[0]			= target->GetColourBuffer(0);
+	buffers[1]			= target->GetColourBuffer(1);
+	depthBuffer			= target->GetDepthBuffer();
+	targetGeneration	= target->GetBufferGeneration();
+
+	BuildHiZ();
+	BuildPortMatrices();
+	BuildTiles();
+}
 
-	float zScale	= (pow(2.0f,16) - 1) * 0.5f;
+/*
+The portMatrix puts the edges of NDC space on the integer coordinates of the
+outermost pixels, which is where the float rasteriser samples. The sub pixel
+rasteriser samples at pixel centres instead, so its matrix stretches NDC space
+over the whole of the outermost pixels.
+*/
+void SoftwareRasteriser::BuildPortMatrices() {
+	float zScale = (pow(2.0f, 16) - 1) * 0.5f;
 
 	Vector3 halfScreen = Vector3((screenWidth - 1) * 0.5f, (screenHeight - 1) * 0.5f, zScale);
 
 	portMatrix = Matrix4::Translation(halfScreen) * Matrix4::Scale(halfScreen);
-}
 
-SoftwareRasteriser::~SoftwareRasteriser(void)	{
-#ifndef USE_OS_BUFFERS
-	for(int i = 0; i < 2; ++i) {
-		delete[] buffers[i];
-	}
-#endif
-	delete[] depthBuffer;
+	Vector3 halfPixels = Vector3(screenWidth * 0.5f, screenHeight * 0.5f, zScale);
+
+	subPixelPortMatrix = Matrix4::Translation(halfPixels) * Matrix4::Scale(halfPixels);
 }
 
-void SoftwareRasteriser::Resize() {
-	Window::Resize(); 
+/*
+Splits the screen up into RASTER_TILE_SIZE square tiles, with the ones along the
+right and bottom edges shrunk to fit. Any triangles still waiting in the old bins
+were binned against the old screen size, so they get thrown away.
+*/
+void SoftwareRasteriser::BuildTiles() {
+	screenTriangles.clear();
 
-#ifndef USE_OS_BUFFERS
-	for (int i = 0; i < 2; ++i) {
-		delete[] buffers[i];
-		buffers[i] = new Colour[screenWidth * screenHeight];
-	}
-#else
-	for (int i = 0; i < 2; ++i) {
-		buffers[i] = (Colour*)bufferData[i];
+	tilesX = (screenWidth  + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+	tilesY = (screenHeight + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+
+	tiles.clear();
+	tiles.resize(tilesX * tilesY);
+
+	for (int y = 0; y < tilesY; ++y) {
+		for (int x = 0; x < tilesX; ++x) {
+			RasterTile &t = tiles[(y * tilesX) + x];
+
+			t.minX = x * RASTER_TILE_SIZE;
+			t.minY = y * RASTER_TILE_SIZE;
+			t.maxX = min(t.minX + RASTER_TILE_SIZE, (int)screenWidth);
+			t.maxY = min(t.minY + RASTER_TILE_SIZE, (int)screenHeight);
+		}
 	}
-#endif
+}
 
-	delete[] depthBuffer;
-	depthBuffer = new unsigned short[screenWidth * screenHeight];
+void SoftwareRasteriser::BuildHiZ() {
+	delete[] hiZBuffer;
 
-	float zScale = (pow(2.0f, 16) - 1) * 0.5f;
+	hiZWidth	= (screenWidth  + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+	hiZHeight	= (screenHeight + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
 
-	Vector3 halfScreen = Vector3((screenWidth - 1) * 0.5f, (screenHeight - 1) * 0.5f, zScale);
+	hiZBuffer	= new unsigned short[hiZWidth * hiZHeight];
+}
 
-	portMatrix = Matrix4::Translation(halfScreen) * Matrix4::Scale(halfScreen);
+bool SoftwareRasteriser::SetRasteriserKernel(RasteriserKernel k) {
+	if ((k == KERNEL_AVX2 && !CPUFeatures::HasAVX2()) ||
+		(k == KERNEL_SSE41 && !CPUFeatures::HasSSE41())) {
+		return false;
+	}
+	rasteriserKernel = k;
+	return true;
 }
 
 Colour*	SoftwareRasteriser::GetCurrentBuffer() {
@@ -97,8 +111,16 @@ Colour*	SoftwareRasteriser::GetCurrentBuffer() {
 }
 
 void	SoftwareRasteriser::ClearBuffers() {
+	CheckTargetSize();
+
 	Colour* buffer = GetCurrentBuffer();
 
+	//Anything still sitting in the tile bins would only be drawn over, so skip it
+	screenTriangles.clear();
+	for (uint i = 0; i < tiles.size(); ++i) {
+		tiles[i].triangles.clear();
+	}
+
 	unsigned int clearVal = 0xFF000000;
 	unsigned int depthVal = ~0;
 
@@ -108,15 +130,42 @@ void	SoftwareRasteriser::ClearBuffers() {
 			depthBuffer[(y * screenWidth) + x] = depthVal;
 		}
 	}
+
+	for (int i = 0; i < hiZWidth * hiZHeight; ++i) {
+		hiZBuffer[i] = depthVal;
+	}
+	for (uint i = 0; i < tiles.size(); ++i) {
+		tiles[i].maxDepth = depthVal;
+	}
 }
 
 void	SoftwareRasteriser::SwapBuffers() {
-	PresentBuffer(buffers[currentDrawBuffer]);
+	FlushTriangles();
+	target->PresentBuffer(buffers[currentDrawBuffer]);
 	currentDrawBuffer = !currentDrawBuffer;
 }
 
 void	SoftwareRasteriser::DrawObject(RenderObject*o) {
-	currentTexture = o->texture;
+	CheckTargetSize();
+
+	//The planes come out in the object's local space, so the mesh bounds can be
+	//tested as they are. Anything entirely off screen can be skipped right away.
+	Frustum frustum(viewProjMatrix * o->GetModelMatrix());
+
+	if (!frustum.InsideFrustum(o->GetMesh()->GetBoundsMin(), o->GetMesh()->GetBoundsMax())) {
+		return;
+	}
+
+	currentTexture	= o->texture;
+	currentCullMode = o->cullMode;
+
+	//Triangles are binned and drawn in batches, but everything else goes
+	//straight to the buffer - to keep things in submission order, any
+	//waiting triangles must be drawn first.
+	if (o->GetMesh()->GetType() != PRIMITIVE_TRIANGLES) {
+		FlushTriangles();
+	}
+
 	switch (o->GetMesh()->GetType()) {
 	case PRIMITIVE_POINTS: {
 							   RasterisePointsMesh(o);
@@ -137,11 +186,38 @@ void	SoftwareRasteriser::DrawObject(RenderObject*o) {
 
 
 
-void	SoftwareRasteriser::RasterisePointsMesh(RenderObject*o) {
+/*
+Every vertex of the mesh goes through the same matrix, so they're all done
+in one go, rather than one at a time as they're needed.
+*/
+const Vector4*	SoftwareRasteriser::TransformMesh(RenderObject*o) {
 	Matrix4 mvp = viewProjMatrix * o->GetModelMatrix();
+	Mesh*	m	= o->GetMesh();
+
+	if (m->numVertices == 0) {
+		return NULL;
+	}
+	if (transformedVertices.size() < m->numVertices) {
+		transformedVertices.resize(m->numVertices);
+	}
+	if (m->layout == VERTEX_SOA) {
+		mvp.TransformVertices(m->positionStreams[0], m->positionStreams[1], m->positionStreams[2], m->positionStreams[3], &transformedVertices[0], m->numVertices);
+	}
+	else {
+		mvp.TransformVertices(m->vertices, &transformedVertices[0], m->numVertices);
+	}
+
+	return &transformedVertices[0];
+}
+
+void	SoftwareRasteriser::RasterisePointsMesh(RenderObject*o) {
+	const Vector4* clipVertices = TransformMesh(o);
+	if (!clipVertices) {
+		return;
+	}
 
 	for (uint i = 0; i < o->GetMesh()->numVertices; ++i) {
-		Vector4 vertexPos = mvp * o->GetMesh()->vertices[i];
+		Vector4 vertexPos = clipVertices[i];
 		vertexPos.SelfDivisionByW();
 
 		Vector4 screenPos = portMatrix * vertexPos;
@@ -150,11 +226,14 @@ void	SoftwareRasteriser::RasterisePointsMesh(RenderObject*o) {
 }
 
 void	SoftwareRasteriser::RasteriseLinesMesh(RenderObject*o) {
-	Matrix4 mvp = viewProjMatrix * o->GetModelMatrix();
+	const Vector4* clipVertices = TransformMesh(o);
+	if (!clipVertices) {
+		return;
+	}
 
 	for (uint i = 0; i < o->GetMesh()->numVertices; i += 2) {
-		Vector4 v0 = mvp * o->GetMesh()->vertices[i];
-		Vector4 v1 = mvp * o->GetMesh()->vertices[i + 1];
+		Vector4 v0 = clipVertices[i];
+		Vector4 v1 = clipVertices[i + 1];
 
 		Colour c0 = o->GetMesh()->colours[i]; 
 		Colour c1 = o->GetMesh()->colours[i + 1];
@@ -167,12 +246,15 @@ void	SoftwareRasteriser::RasteriseLinesMesh(RenderObject*o) {
 }
 
 void	SoftwareRasteriser::RasteriseLineLoops(RenderObject*o) {
-	Matrix4 mvp = viewProjMatrix * o->GetModelMatrix();
+	const Vector4* clipVertices = TransformMesh(o);
+	if (!clipVertices) {
+		return;
+	}
 
 	for (uint i = 0; i < o->GetMesh()->numVertices-1; i += 1) {
 
-		Vector4 v0 = mvp * o->GetMesh()->vertices[i];
-		Vector4 v1 = mvp * o->GetMesh()->vertices[i + 1];
+		Vector4 v0 = clipVertices[i];
+		Vector4 v1 = clipVertices[i + 1];
 
 		Colour c0 = o->GetMesh()->colours[i];
 		Colour c1 = o->GetMesh()->colours[i + 1];
@@ -183,8 +265,8 @@ void	SoftwareRasteriser::RasteriseLineLoops(RenderObject*o) {
 		
 		RasteriseLine(v0, v1, c0, c1);
 	}
-	Vector4 v0 = mvp * o->GetMesh()->vertices[0];
-	Vector4 v1 = mvp * o->GetMesh()->vertices[o->GetMesh()->numVertices -1];
+	Vector4 v0 = clipVertices[0];
+	Vector4 v1 = clipVertices[o->GetMesh()->numVertices -1];
 
 	Colour c0 = o->GetMesh()->colours[0];
 	Colour c1 = o->GetMesh()->colours[o->GetMesh()->numVertices -1];
@@ -197,40 +279,192 @@ void	SoftwareRasteriser::RasteriseLineLoops(RenderObject*o) {
 }
 
 
+static int ClipOutcode(const Vector4 &v);
+
+void	SoftwareRasteriser::ProjectVertices(const Mesh* m, const Vector4* clipVertices) {
+	if (projectedVertices.size() < m->numVertices) {
+		projectedVertices.resize(m->numVertices);
+	}
+	for (uint i = 0; i < m->numVertices; ++i) {
+		ProjectedVertex &p = projectedVertices[i];
+
+		p.outcode = ClipOutcode(clipVertices[i]);
+		if (p.outcode) {
+			continue;
+		}
+		const Vector2 &t = m->textureCoords[i];
+
+		p.texCoord = Vector3(t.x, t.y, 1.0f) / clipVertices[i].w;
+		p.position = clipVertices[i];
+		p.position.SelfDivisionByW();
+	}
+}
+
+/*
+Triangles with all 3 vertices inside every clipping plane - nearly all of
+them, usually - go straight from the projected vertices to RasteriseTri. 
+Only those crossing a plane need their clip space positions clipping, which
+gives exactly the same result as if they had all gone that way.
+*/
 void	SoftwareRasteriser::RasteriseTriMesh(RenderObject*o) {
-	Matrix4 mvp = viewProjMatrix * o->GetModelMatrix();
-	
-		for (uint i = 0; i < o->GetMesh()->numVertices; i += 3) {
-		Vector4 v0 = mvp * o->GetMesh()->vertices[i];
-		Vector4 v1 = mvp * o->GetMesh()->vertices[i + 1];
-		Vector4 v2 = mvp * o->GetMesh()->vertices[i + 2];
-
-			Vector3 t0 = Vector3(
-			o->GetMesh()->textureCoords[i].x,
-			o->GetMesh()->textureCoords[i].y, 1.0f) / v0.w;
-		
-			Vector3 t1 = Vector3(
-			o->GetMesh()->textureCoords[i + 1].x,
-			o->GetMesh()->textureCoords[i + 1].y, 1.0f) / v1.w;
-		
-			Vector3 t2 = Vector3(
-			o->GetMesh()->textureCoords[i + 2].x,
-			o->GetMesh()->textureCoords[i + 2].y, 1.0f) / v2.w;
+	const Vector4*	clipVertices	= TransformMesh(o);
+	Mesh*			m				= o->GetMesh();
 
-		v0.SelfDivisionByW(); v1.SelfDivisionByW(); v2.SelfDivisionByW();
+	if (!clipVertices) {
+		return;
+	}
+
+	ProjectVertices(m, clipVertices);
+
+	bool indexed	= (m->indexType != INDEX_NONE);
+	uint corners	= indexed ? m->numIndices : m->numVertices;
+
+	ClipVertex tri[3];
 
+	for (uint i = 0; i + 2 < corners; i += 3) {
+		uint index[3];
+		for (uint j = 0; j < 3; ++j) {
+			index[j] = indexed ? m->GetIndex(i + j) : i + j;
+		}
+		const ProjectedVertex &a = projectedVertices[index[0]];
+		const ProjectedVertex &b = projectedVertices[index[1]];
+		const ProjectedVertex &c = projectedVertices[index[2]];
+
+		if (a.outcode & b.outcode & c.outcode) {
+			continue;	//Entirely outside of one of the planes
+		}
+		if (!(a.outcode | b.outcode | c.outcode)) {
+			RasteriseTri(a.position, b.position, c.position,
+				m->colours[index[0]], m->colours[index[1]], m->colours[index[2]],
+				a.texCoord, b.texCoord, c.texCoord);
+			continue;
+		}
 
-		RasteriseTri(v0, v1, v2, 
-			o->GetMesh()->colours[i], 
-			o->GetMesh()->colours[i + 1], 
-			o->GetMesh()->colours[i + 2],
-			t0,t1,t2
-			);
+		for (uint j = 0; j < 3; ++j) {
+			tri[j].position = clipVertices[index[j]];
+			tri[j].colour	= m->colours[index[j]];
+			tri[j].texCoord = m->textureCoords[index[j]];
+		}
+
+		ClipVertex	polygon[MAX_CLIP_VERTICES];
+		uint		numVertices = ClipTriangle(tri, polygon);
+
+		//Clipping a triangle leaves us with a convex polygon, so it can be fanned
+		for (uint j = 1; j + 1 < numVertices; ++j) {
+			RasteriseClipSpaceTri(polygon[0], polygon[j], polygon[j + 1]);
+		}
 	}
 }
 
+void	SoftwareRasteriser::RasteriseClipSpaceTri(const ClipVertex &a, const ClipVertex &b, const ClipVertex &c) {
+	Vector4 v0 = a.position;
+	Vector4 v1 = b.position;
+	Vector4 v2 = c.position;
 
+	Vector3 t0 = Vector3(a.texCoord.x, a.texCoord.y, 1.0f) / v0.w;
+	Vector3 t1 = Vector3(b.texCoord.x, b.texCoord.y, 1.0f) / v1.w;
+	Vector3 t2 = Vector3(c.texCoord.x, c.texCoord.y, 1.0f) / v2.w;
 
+	v0.SelfDivisionByW(); v1.SelfDivisionByW(); v2.SelfDivisionByW();
+
+	RasteriseTri(v0, v1, v2, a.colour, b.colour, c.colour, t0, t1, t2);
+}
+
+/*
+Clip space planes, as (a,b,c,d) - a vertex is inside a plane if the dot product
+of the plane and its clip space position is positive. Only the near plane has
+to be clipped against properly, as it's the only one that stops the divide by
+w going wrong. For the sides, we use a 'guard band' a good way outside of the 
+screen instead - anything poking out past the screen edge, but not the guard 
+band, can just be left for the bounding box clamping to deal with. Triangles 
+entirely behind the far plane are thrown away, and pixels partly behind it are
+handled by the depth range check.
+*/
+static const Vector4 clipPlanes[NUM_CLIP_PLANES + 1] = {
+	Vector4( 0.0f,  0.0f,  1.0f, 1.0f),				//Near
+	Vector4( 1.0f,  0.0f,  0.0f, CLIP_GUARD_BAND),	//Left guard band
+	Vector4(-1.0f,  0.0f,  0.0f, CLIP_GUARD_BAND),	//Right guard band
+	Vector4( 0.0f,  1.0f,  0.0f, CLIP_GUARD_BAND),	//Bottom guard band
+	Vector4( 0.0f, -1.0f,  0.0f, CLIP_GUARD_BAND),	//Top guard band
+	Vector4( 0.0f,  0.0f, -1.0f, 1.0f)				//Far - rejection only
+};
+
+static inline float ClipPlaneDistance(const Vector4 &plane, const Vector4 &v) {
+	return (plane.x * v.x) + (plane.y * v.y) + (plane.z * v.z) + (plane.w * v.w);
+}
+
+//Has a bit set for each of the planes the vertex is outside of
+static int ClipOutcode(const Vector4 &v) {
+	int outcode = 0;
+	for (int p = 0; p < NUM_CLIP_PLANES + 1; ++p) {
+		if (ClipPlaneDistance(clipPlanes[p], v) < 0.0f) {
+			outcode |= (1 << p);
+		}
+	}
+	return outcode;
+}
+
+/*
+Sutherland-Hodgman clipping of a clip space triangle. Fills 'out' with the
+vertices of the clipped polygon, and returns how many there are - 0 if the
+triangle can't be seen at all. Triangles that are entirely on the wrong side
+of a plane are rejected before any clipping is done, and ones that don't cross
+any of the clipping planes are passed straight through.
+*/
+uint	SoftwareRasteriser::ClipTriangle(const ClipVertex* in, ClipVertex* out) {
+	int outsideAll = ~0;
+	int outsideAny = 0;
+
+	for (int i = 0; i < 3; ++i) {
+		int outcode = ClipOutcode(in[i].position);
+		outsideAll &= outcode;
+		outsideAny |= outcode;
+	}
+
+	if (outsideAll) {
+		return 0;
+	}
+
+	for (int i = 0; i < 3; ++i) {
+		out[i] = in[i];
+	}
+	uint numVertices = 3;
+
+	ClipVertex temp[MAX_CLIP_VERTICES];
+
+	for (int p = 0; p < NUM_CLIP_PLANES && numVertices >= 3; ++p) {
+		if (!(outsideAny & (1 << p))) {
+			continue;
+		}
+		uint clippedVertices = 0;
+
+		for (uint i = 0; i < numVertices; ++i) {
+			const ClipVertex &current	= out[i];
+			const ClipVertex &next		= out[(i + 1) % numVertices];
+
+			float currentDist	= ClipPlaneDistance(clipPlanes[p], current.position);
+			float nextDist		= ClipPlaneDistance(clipPlanes[p], next.position);
+
+			if (currentDist >= 0.0f) {
+				temp[clippedVertices++] = current;
+			}
+			if ((currentDist >= 0.0f) != (nextDist >= 0.0f)) {
+				float t = currentDist / (currentDist - nextDist);
+
+				ClipVertex &v = temp[clippedVertices++];
+				v.position	= Vector4::Lerp(current.position, next.position, t);
+				v.colour	= Colour::Lerp(current.colour, next.colour, t);
+				v.texCoord	= Vector2::Lerp(current.texCoord, next.texCoord, t);
+			}
+		}
+
+		for (uint i = 0; i < clippedVertices; ++i) {
+			out[i] = temp[i];
+		}
+		numVertices = clippedVertices;
+	}
+	return numVertices >= 3 ? numVertices : 0;
+}
 
 void SoftwareRasteriser::RasteriseLine(
 	const Vector4 &vertA, const Vector4 &vertB,
@@ -316,12 +550,12 @@ void SoftwareRasteriser::RasteriseLine(
 			box.bottomRight.x = a.x; 
 		box.bottomRight.x = max(box.bottomRight.x, b.x); 
 		box.bottomRight.x = max(box.bottomRight.x, c.x); 
-		box.bottomRight.x = min(box.bottomRight.x, screenWidth); 
+		box.bottomRight.x = min(box.bottomRight.x, (float)screenWidth); 
 		
 			box.bottomRight.y = a.y;
 		box.bottomRight.y = max(box.bottomRight.y, b.y);
 		box.bottomRight.y = max(box.bottomRight.y, c.y);
-		box.bottomRight.y = min(box.bottomRight.y, screenHeight); 
+		box.bottomRight.y = min(box.bottomRight.y, (float)screenHeight); 
 		
 			return box;
 		
@@ -336,65 +570,436 @@ void SoftwareRasteriser::RasteriseLine(
 		
 	}
 
-	void SoftwareRasteriser::RasteriseTri(
-		const Vector4 &triA, const Vector4 &triB, const Vector4 &triC,
-		const Colour &colA, const Colour &colB, const Colour &colC,
-		const Vector3 &texA, const Vector3 &texB, const Vector3 & texC) {
-		
-		Vector4 v0 = portMatrix * triA;
-		Vector4 v1 = portMatrix * triB;
-		Vector4 v2 = portMatrix * triC;
-		
-			BoundingBox b = CalculateBoxForTri(v0, v1, v2);
-		
-			float triArea = ScreenAreaOfTri(v0, v1, v2);
-			float areaRecip = 1.0f / triArea;
+void SoftwareRasteriser::RasteriseTri(
+	const Vector4 &triA, const Vector4 &triB, const Vector4 &triC,
+	const Colour &colA, const Colour &colB, const Colour &colC,
+	const Vector3 &texA, const Vector3 &texB, const Vector3 &texC) {
 
-			float subTriArea[3];
-		Vector4 screenPos(0, 0, 0, 1);
-		
-			for (float y = b.topLeft.y; y < b.bottomRight.y; ++y) {
-				for (float x = b.topLeft.x; x < b.bottomRight.x; ++x) {
-					screenPos.x = x; 
-					screenPos.y = y; 
+	ScreenTriangle tri;
+
+	tri.subPixel = (rasteriserPrecision == PRECISION_SUBPIXEL);
+
+	const Matrix4 &port = tri.subPixel ? subPixelPortMatrix : portMatrix;
+
+	tri.v[0] = port * triA;
+	tri.v[1] = port * triB;
+	tri.v[2] = port * triC;
+
+	//Counter clockwise triangles have a positive area, and are front facing
+	float triArea;
+
+	if (tri.subPixel) {
+		for (int i = 0; i < 3; ++i) {
+			tri.fixedX[i] = (int)floor((tri.v[i].x * SUBPIXEL_SCALE) + 0.5f);
+			tri.fixedY[i] = (int)floor((tri.v[i].y * SUBPIXEL_SCALE) + 0.5f);
+		}
+		//The area has to come from the snapped positions, or a sliver could
+		//flip over when snapped, and get culled (or not) by mistake
+		long long fixedArea =
+			((long long)(tri.fixedX[1] - tri.fixedX[0]) * (tri.fixedY[2] - tri.fixedY[0])) -
+			((long long)(tri.fixedY[1] - tri.fixedY[0]) * (tri.fixedX[2] - tri.fixedX[0]));
+
+		triArea = (float)fixedArea * (0.5f / (SUBPIXEL_SCALE * SUBPIXEL_SCALE));
+	}
+	else {
+		triArea = ScreenAreaOfTri(tri.v[0], tri.v[1], tri.v[2]);
+	}
+
+	if (!(triArea > 0.0f || triArea < 0.0f)) {
+		return; //Zero area (or NaN, if something's gone very wrong!)
+	}
+	if ((currentCullMode == CULL_BACK && triArea < 0.0f) ||
+		(currentCullMode == CULL_FRONT && triArea > 0.0f)) {
+		return;
+	}
+
+	if (tri.subPixel) {
+		//Pixel centres are half a pixel in from the integer coordinates. The
+		//shifts round towards negative infinity, even for negative positions.
+		const int halfPixel = SUBPIXEL_SCALE / 2;
+
+		int fixedMinX = min(tri.fixedX[0], min(tri.fixedX[1], tri.fixedX[2]));
+		int fixedMinY = min(tri.fixedY[0], min(tri.fixedY[1], tri.fixedY[2]));
+		int fixedMaxX = max(tri.fixedX[0], max(tri.fixedX[1], tri.fixedX[2]));
+		int fixedMaxY = max(tri.fixedY[0], max(tri.fixedY[1], tri.fixedY[2]));
+
+		tri.minX = max((fixedMinX - halfPixel + SUBPIXEL_SCALE - 1) >> SUBPIXEL_BITS, 0);
+		tri.minY = max((fixedMinY - halfPixel + SUBPIXEL_SCALE - 1) >> SUBPIXEL_BITS, 0);
+		tri.maxX = min(((fixedMaxX - halfPixel) >> SUBPIXEL_BITS) + 1, (int)screenWidth);
+		tri.maxY = min(((fixedMaxY - halfPixel) >> SUBPIXEL_BITS) + 1, (int)screenHeight);
+	}
+	else {
+		BoundingBox b = CalculateBoxForTri(tri.v[0], tri.v[1], tri.v[2]);
+
+		//Pixels are sampled at integer coordinates, so the box is shrunk to only
+		//those samples actually inside of it. 
+		tri.minX = (int)ceil(b.topLeft.x);
+		tri.minY = (int)ceil(b.topLeft.y);
+		tri.maxX = min((int)floor(b.bottomRight.x) + 1, (int)screenWidth);
+		tri.maxY = min((int)floor(b.bottomRight.y) + 1, (int)screenHeight);
+	}
+
+	if (tri.minX >= tri.maxX || tri.minY >= tri.maxY) {
+		return; //Entirely off screen, or so small it falls between samples
+	}
+
+	tri.colours[0]		= colA;
+	tri.colours[1]		= colB;
+	tri.colours[2]		= colC;
+	tri.texCoords[0]	= texA;
+	tri.texCoords[1]	= texB;
+	tri.texCoords[2]	= texC;
+	tri.texture			= currentTexture;
+	tri.areaRecip		= 1.0f / triArea;
+	tri.depthFunction	= depthFunction;
+	tri.depthWrite		= depthWrite;
+	tri.textureFilter	= textureFilter;
+
+	if (tri.texture) {
+		//The barycentric weights are linear in screen space, so their steps 
+		//give the texture coordinate derivatives directly
+		EdgeEquation alphaEdge(tri.v[1], tri.v[2], Vector2(), tri.areaRecip);
+		EdgeEquation betaEdge (tri.v[2], tri.v[0], Vector2(), tri.areaRecip);
+		EdgeEquation gammaEdge(tri.v[0], tri.v[1], Vector2(), tri.areaRecip);
+
+		tri.texGradientX = (texA * alphaEdge.stepX) + (texB * betaEdge.stepX) + (texC * gammaEdge.stepX);
+		tri.texGradientY = (texA * alphaEdge.stepY) + (texB * betaEdge.stepY) + (texC * gammaEdge.stepY);
+
+		tri.texGradientX.x *= tri.texture->GetWidth();
+		tri.texGradientX.y *= tri.texture->GetHeight();
+		tri.texGradientY.x *= tri.texture->GetWidth();
+		tri.texGradientY.y *= tri.texture->GetHeight();
+	}
+
+	float minZ = min(tri.v[0].z, min(tri.v[1].z, tri.v[2].z));
+	tri.minDepth		= (unsigned short)clamp(minZ, 0.0f, MAX_DEPTH);
+
+	uint index = (uint)screenTriangles.size();
+	screenTriangles.push_back(tri);
+
+	int lastTileX = (tri.maxX - 1) / RASTER_TILE_SIZE;
+	int lastTileY = (tri.maxY - 1) / RASTER_TILE_SIZE;
+
+	for (int y = tri.minY / RASTER_TILE_SIZE; y <= lastTileY; ++y) {
+		for (int x = tri.minX / RASTER_TILE_SIZE; x <= lastTileX; ++x) {
+			tiles[(y * tilesX) + x].triangles.push_back(index);
+		}
+	}
+}
 
-					subTriArea[0] = abs(ScreenAreaOfTri(v0, screenPos, v1));
-					subTriArea[1] = abs(ScreenAreaOfTri(v1, screenPos, v2));
-					subTriArea[2] = abs(ScreenAreaOfTri(v2, screenPos, v0));
+/*
+Hands every tile that has something binned in it to the thread pool, and waits
+for them all to be filled. Tiles keep their triangle indices in submission order,
+so each pixel still sees its triangles in the order they were drawn.
+*/
+void SoftwareRasteriser::FlushTriangles() {
+	if (screenTriangles.empty()) {
+		return;
+	}
+
+	for (uint i = 0; i < tiles.size(); ++i) {
+		if (tiles[i].triangles.empty()) {
+			continue;
+		}
+		RasterTile* tile = &tiles[i];
+		threadPool.AddJob([this, tile]() {
+			RasteriseTile(*tile);
+		});
+	}
+	threadPool.WaitForJobs();
 
-					float triSum = subTriArea[0] + subTriArea[1] + subTriArea[2];
+	screenTriangles.clear();
+}
 
-					if (triSum > (triArea + 0.9f)) {
-						continue;
+void SoftwareRasteriser::RasteriseTile(RasterTile &tile) {
+	for (uint i = 0; i < tile.triangles.size(); ++i) {
+		RasteriseTri(screenTriangles[tile.triangles[i]], tile);
+	}
+	tile.triangles.clear();
+}
 
-					}
-					if (triSum < 1.0f) { 
-						continue;
+/*
+Fills in the part of a triangle that overlaps the given tile. This can be called
+from any of the pool threads, so it mustn't touch anything outside of the tile!
 
-					}
+Before any pixels are looked at, the triangle's nearest depth is checked against
+the furthest depth in the tile, and then against each hiZ block it covers - if
+it's behind everything already drawn there, that whole area can be skipped.
+*/
+void SoftwareRasteriser::RasteriseTri(const ScreenTriangle &tri, RasterTile &tile) {
+	if (DepthOccluded(tri.depthFunction, tri.minDepth, tile.maxDepth)) {
+		return;
+	}
 
-					float alpha = subTriArea[1] * areaRecip;
-					float beta = subTriArea[2] * areaRecip;
-					float gamma = subTriArea[0] * areaRecip;
+	int minX = max(tri.minX, tile.minX);
+	int minY = max(tri.minY, tile.minY);
+	int maxX = min(tri.maxX, tile.maxX);
+	int maxY = min(tri.maxY, tile.maxY);
 
-					if (currentTexture){
-						Vector3 subTex = (texA * alpha) + (texB * beta) + (texC* gamma);
+	bool tileWritten = false;
 
-						subTex.x /= subTex.z;
-						subTex.y /= subTex.z;
+	for (int blockY = minY / HIZ_BLOCK_SIZE; blockY <= (maxY - 1) / HIZ_BLOCK_SIZE; ++blockY) {
+		for (int blockX = minX / HIZ_BLOCK_SIZE; blockX <= (maxX - 1) / HIZ_BLOCK_SIZE; ++blockX) {
+			unsigned short &blockDepth = hiZBuffer[(blockY * hiZWidth) + blockX];
 
-						ShadePixel((int)x, (int)y, currentTexture->NearestTextSample(subTex));
+			if (DepthOccluded(tri.depthFunction, tri.minDepth, blockDepth)) {
+				continue;
+			}
 
-					}
-					else{
-						Colour subColour = ((colA * alpha) +
-						(colB * beta) +
-						(colC * gamma));
+			int startX = max(minX, blockX * HIZ_BLOCK_SIZE);
+			int startY = max(minY, blockY * HIZ_BLOCK_SIZE);
+			int endX = min(maxX, (blockX + 1) * HIZ_BLOCK_SIZE);
+			int endY = min(maxY, (blockY + 1) * HIZ_BLOCK_SIZE);
 
-					ShadePixel((uint)x, (uint)y, subColour);
-				}
+			if (RasteriseTriRect(tri, startX, startY, endX, endY)) {
+				blockDepth	= CalculateBlockMaxDepth(blockX, blockY);
+				tileWritten = true;
 			}
-			
 		}
-		
-	}
\ No newline at end of file
+	}
+
+	if (tileWritten) {
+		tile.maxDepth = 0;
+		for (int blockY = tile.minY / HIZ_BLOCK_SIZE; blockY <= (tile.maxY - 1) / HIZ_BLOCK_SIZE; ++blockY) {
+			for (int blockX = tile.minX / HIZ_BLOCK_SIZE; blockX <= (tile.maxX - 1) / HIZ_BLOCK_SIZE; ++blockX) {
+				tile.maxDepth = max(tile.maxDepth, hiZBuffer[(blockY * hiZWidth) + blockX]);
+			}
+		}
+	}
+}
+
+unsigned short SoftwareRasteriser::CalculateBlockMaxDepth(int blockX, int blockY) {
+	int startX	= blockX * HIZ_BLOCK_SIZE;
+	int startY	= blockY * HIZ_BLOCK_SIZE;
+	int endX	= min(startX + HIZ_BLOCK_SIZE, (int)screenWidth);
+	int endY	= min(startY + HIZ_BLOCK_SIZE, (int)screenHeight);
+
+	unsigned short maxDepth = 0;
+
+	for (int y = startY; y < endY; ++y) {
+		unsigned short* depthRow = &depthBuffer[y * screenWidth];
+		for (int x = startX; x < endX; ++x) {
+			maxDepth = max(maxDepth, depthRow[x]);
+		}
+	}
+	return maxDepth;
+}
+
+/*
+Fills in the part of a triangle inside the given pixel rectangle. Returns true
+if anything was written to the depth buffer, so the hiZ can be kept up to date.
+
+The SIMD kernels live in SoftwareRasteriserSIMD.cpp - this one does a pixel at
+a time, and is kept as the reference they're checked against.
+*/
+bool SoftwareRasteriser::RasteriseTriRect(const ScreenTriangle &tri, int minX, int minY, int maxX, int maxY) {
+	if (tri.subPixel) {
+		return RasteriseTriRectSubPixel(tri, minX, minY, maxX, maxY);
+	}
+	switch (rasteriserKernel) {
+	case KERNEL_AVX2:	return RasteriseTriRectAVX2(tri, minX, minY, maxX, maxY);
+	case KERNEL_SSE41:	return RasteriseTriRectSSE41(tri, minX, minY, maxX, maxY);
+	default:			return RasteriseTriRectScalar(tri, minX, minY, maxX, maxY);
+	}
+}
+
+/*
+How many texels a pixel covers, squared. The texture coordinates are u/w and
+v/w divided by 1/w, so by the quotient rule their screen space derivatives are
+(d(u/w) - u * d(1/w)) / (1/w) - this is the squared length of the longer of 
+the x and y derivative vectors. The SIMD kernels do exactly the same sums in 
+the same order, so they all pick the same mip levels.
+*/
+static inline float MipFootprint(const ScreenTriangle &tri, float u, float v, float w) {
+	float texelU = u * (float)tri.texture->GetWidth();
+	float texelV = v * (float)tri.texture->GetHeight();
+
+	float dudx = tri.texGradientX.x - (texelU * tri.texGradientX.z);
+	float dvdx = tri.texGradientX.y - (texelV * tri.texGradientX.z);
+	float dudy = tri.texGradientY.x - (texelU * tri.texGradientY.z);
+	float dvdy = tri.texGradientY.y - (texelV * tri.texGradientY.z);
+
+	float lengthX = (dudx * dudx) + (dvdx * dvdx);
+	float lengthY = (dudy * dudy) + (dvdy * dvdy);
+
+	return max(lengthX, lengthY) / (w * w);
+}
+
+/*
+The nearest mip level is log2 of the footprint's square root. That doesn't 
+need an actual log2: half the footprint's exponent, rounded, is the same thing.
+*/
+static inline int SelectMipLevel(const ScreenTriangle &tri, float u, float v, float w) {
+	float footprint = MipFootprint(tri, u, v, w);
+
+	int bits;
+	memcpy(&bits, &footprint, sizeof(float));
+
+	int level = (((bits >> 23) & 0xFF) - 127 + 1) >> 1;
+
+	return clamp(level, 0, (int)tri.texture->GetMipLevels() - 1);
+}
+
+/*
+Trilinear filtering needs the fractional level too. A float's bits, read as 
+an int and scaled down by 2^23, are its exponent plus its mantissa's fraction,
+biased by 127 - a piecewise linear log2, that's exact at powers of two.
+*/
+static inline float SelectMipLOD(const ScreenTriangle &tri, float u, float v, float w) {
+	float footprint = MipFootprint(tri, u, v, w);
+
+	int bits;
+	memcpy(&bits, &footprint, sizeof(float));
+
+	float lod = (((float)bits * (1.0f / 8388608.0f)) - 127.0f) * 0.5f;
+
+	return clamp(lod, 0.0f, (float)(tri.texture->GetMipLevels() - 1));
+}
+
+inline bool SoftwareRasteriser::ShadeTriPixel(const ScreenTriangle &tri, int x, int y, float alpha, float beta, float gamma) {
+	//Screen space z is linear after the divide by w, so the same weights work for it
+	float z = (tri.v[0].z * alpha) + (tri.v[1].z * beta) + (tri.v[2].z * gamma);
+
+	if (z < 0.0f || z > MAX_DEPTH) {
+		return false; //In front of the near plane, or past the far plane
+	}
+	unsigned short depth	= (unsigned short)z;
+	unsigned short &stored	= depthBuffer[(y * screenWidth) + x];
+
+	if (!DepthTest(tri.depthFunction, depth, stored)) {
+		return false;
+	}
+	if (tri.depthWrite) {
+		stored = depth;
+	}
+
+	if (tri.texture) {
+		Vector3 subTex = (tri.texCoords[0] * alpha) + (tri.texCoords[1] * beta) + (tri.texCoords[2] * gamma);
+
+		subTex.x /= subTex.z;
+		subTex.y /= subTex.z;
+
+		switch (tri.textureFilter) {
+		case FILTER_NEAREST:
+			ShadePixel(x, y, tri.texture->NearestTextSample(subTex, SelectMipLevel(tri, subTex.x, subTex.y, subTex.z)));
+			break;
+		case FILTER_BILINEAR:
+			ShadePixel(x, y, tri.texture->BilinearTextSample(subTex, SelectMipLevel(tri, subTex.x, subTex.y, subTex.z)));
+			break;
+		case FILTER_TRILINEAR:
+			ShadePixel(x, y, tri.texture->TrilinearTextSample(subTex, SelectMipLOD(tri, subTex.x, subTex.y, subTex.z)));
+			break;
+		}
+	}
+	else {
+		Colour subColour = ((tri.colours[0] * alpha) +
+			(tri.colours[1] * beta) +
+			(tri.colours[2] * gamma));
+
+		ShadePixel(x, y, subColour);
+	}
+	return tri.depthWrite;
+}
+
+bool SoftwareRasteriser::RasteriseTriRectScalar(const ScreenTriangle &tri, int minX, int minY, int maxX, int maxY) {
+	bool depthWritten = false;
+
+	/*
+	Rather than working out the area of 3 sub triangles for every pixel, we set up
+	an edge equation per triangle edge. Each one is linear in x and y, so moving 
+	one pixel along a row (or down a row) changes it by a constant amount - the
+	whole inner loop then becomes 3 multiply-adds and a sign test. The equations
+	are scaled by the triangle area, so they give the barycentric weights directly.
+	*/
+	Vector2 origin((float)minX, (float)minY);
+
+	EdgeEquation alphaEdge(tri.v[1], tri.v[2], origin, tri.areaRecip);
+	EdgeEquation betaEdge (tri.v[2], tri.v[0], origin, tri.areaRecip);
+	EdgeEquation gammaEdge(tri.v[0], tri.v[1], origin, tri.areaRecip);
+
+	for (int y = minY; y < maxY; ++y) {
+		for (int x = minX; x < maxX; ++x) {
+			float alpha = alphaEdge.At(x - minX);
+			float beta	= betaEdge.At(x - minX);
+			float gamma = gammaEdge.At(x - minX);
+
+			if (alpha < 0.0f || beta < 0.0f || gamma < 0.0f) {
+				continue;
+			}
+			if (ShadeTriPixel(tri, x, y, alpha, beta, gamma)) {
+				depthWritten = true;
+			}
+		}
+		alphaEdge.NextRow();
+		betaEdge.NextRow();
+		gammaEdge.NextRow();
+	}
+	return depthWritten;
+}
+
+/*
+The same edge equations as the float kernel, but worked out exactly, on the
+snapped vertex positions, with pixels sampled at their centres. Both the positions
+and sample points have SUBPIXEL_BITS of fraction, so the equations have twice
+that - too much for an int, once the guard band is taken into account.
+
+A pixel centre lying exactly on an edge is only filled if it's a top or left
+edge - the neighbouring triangle sees that edge running the other way, as a
+bottom or right edge, so exactly one of them will fill it. As the rows of our
+buffer go bottom to top, a left edge is one heading down the screen, and a top 
+edge is a flat one heading left.
+*/
+bool SoftwareRasteriser::RasteriseTriRectSubPixel(const ScreenTriangle &tri, int minX, int minY, int maxX, int maxY) {
+	bool depthWritten = false;
+
+	const int halfPixel = SUBPIXEL_SCALE / 2;
+
+	int sampleX = (minX << SUBPIXEL_BITS) + halfPixel;
+	int sampleY = (minY << SUBPIXEL_BITS) + halfPixel;
+
+	//Clockwise triangles get their equations flipped, so inside is always positive
+	long long facing = tri.areaRecip > 0.0f ? 1 : -1;
+
+	long long stepX[3];
+	long long stepY[3];
+	long long rowStart[3];
+	long long bias[3];
+
+	//Edge i is the one opposite vertex i, so it gives that vertex's weight
+	for (int i = 0; i < 3; ++i) {
+		int a = (i + 1) % 3;
+		int b = (i + 2) % 3;
+
+		long long dx = tri.fixedX[b] - tri.fixedX[a];
+		long long dy = tri.fixedY[b] - tri.fixedY[a];
+
+		stepX[i]	= -dy * SUBPIXEL_SCALE * facing;
+		stepY[i]	=  dx * SUBPIXEL_SCALE * facing;
+		rowStart[i] = ((dx * (sampleY - tri.fixedY[a])) - (dy * (sampleX - tri.fixedX[a]))) * facing;
+
+		bool topLeft = stepX[i] > 0 || (stepX[i] == 0 && stepY[i] < 0);
+		bias[i] = topLeft ? 0 : 1;
+	}
+
+	//The equations always sum to twice the triangle's area
+	float weightScale = 1.0f / (float)(rowStart[0] + rowStart[1] + rowStart[2]);
+
+	for (int y = minY; y < maxY; ++y) {
+		long long e0 = rowStart[0];
+		long long e1 = rowStart[1];
+		long long e2 = rowStart[2];
+
+		for (int x = minX; x < maxX; ++x, e0 += stepX[0], e1 += stepX[1], e2 += stepX[2]) {
+			if (e0 < bias[0] || e1 < bias[1] || e2 < bias[2]) {
+				continue;
+			}
+			if (ShadeTriPixel(tri, x, y, e0 * weightScale, e1 * weightScale, e2 * weightScale)) {
+				depthWritten = true;
+			}
+		}
+		rowStart[0] += stepY[0];
+		rowStart[1] += stepY[1];
+		rowStart[2] += stepY[2];
+	}
+	return depthWritten;
+}
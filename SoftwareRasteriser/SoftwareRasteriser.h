@@ -1,12 +1,15 @@
 /******************************************************************************
 Class:SoftwareRasteriser
-Implements:Window
+Implements:
 Author:Rich Davison	<richard.davison4@newcastle.ac.uk>
 Description: Class to encapsulate the various rasterisation techniques looked
 at in the course material.
 
 This is the class you'll be modifying the most!
 
+It draws into the buffers of a RenderTarget - either a Window, to see the 
+results on screen, or a HeadlessTarget, to do something else with them.
+
 -_-_-_-_-_-_-_,------,   
 _-_-_-_-_-_-_-|   /\_/\   NYANYANYAN
 -_-_-_-_-_-_-~|__( ^ .^) /
@@ -21,28 +24,197 @@ _-_-_-_-_-_-_-""  ""
 #include "Texture.h"
 #include "RenderObject.h"
 #include "Common.h"
-#include "Window.h"
+#include "RenderTarget.h"
+#include "ThreadPool.h"
+#include "Frustum.h"
 
 #include <vector>
 
 using std::vector;
 
+class RenderObject;
+class Texture;
+
+//Which set of instructions RasteriseTriRect uses to fill pixels
+enum RasteriserKernel {
+	KERNEL_SCALAR,	//One pixel at a time - the reference implementation
+	KERNEL_SSE41,	//4 pixels along a row at a time
+	KERNEL_AVX2		//8 pixels along a row at a time
+};
+
+//How RasteriseTri decides which pixels a triangle covers
+enum RasteriserPrecision {
+	PRECISION_FLOAT,	//Float edge equations, sampled on the integer pixel coordinates
+	PRECISION_SUBPIXEL	//Vertices snapped to a fixed point grid, integer edge equations
+};
+
+//How an incoming fragment's depth is compared against the depth buffer
+enum DepthFunction {
+	DEPTH_NEVER,
+	DEPTH_LESS,
+	DEPTH_EQUAL,
+	DEPTH_LESS_EQUAL,
+	DEPTH_GREATER,
+	DEPTH_NOT_EQUAL,
+	DEPTH_GREATER_EQUAL,
+	DEPTH_ALWAYS
+};
+
+//How textures are sampled. Every mode picks a mip level from how many texels
+//each pixel covers - see SelectMipLevel.
+enum TextureFilter {
+	FILTER_NEAREST,		//The single nearest texel, from the nearest mip level
+	FILTER_BILINEAR,	//A blend of the 4 nearest texels, from the nearest mip level
+	FILTER_TRILINEAR	//Bilinear samples from the two nearest mip levels, blended
+};
+
 struct BoundingBox {
 	Vector2 topLeft;
 	Vector2 bottomRight;
 };
 
+/*
+Edge equation for the triangle edge running from a to b. Evaluated at a point it
+gives twice the signed area of the triangle (a, b, point) - scaling that by the 
+reciprocal of the whole triangle's area gives the barycentric weight of the vertex
+opposite the edge. As it's linear, we only ever need to step it, not recalculate it.
+*/
+struct EdgeEquation {
+	EdgeEquation(const Vector4 &a, const Vector4 &b, const Vector2 &origin, float areaRecip) {
+		float scale = 0.5f * areaRecip;
+
+		stepX		= (a.y - b.y) * scale;
+		stepY		= (b.x - a.x) * scale;
+		rowStart	= (((b.x - a.x) * (origin.y - a.y)) - ((b.y - a.y) * (origin.x - a.x))) * scale;
+	}
+
+	inline void NextRow() {
+		rowStart += stepY;
+	}
+
+	//Weight at the given pixel along the current row. Worked out afresh for
+	//each pixel, rather than adding on stepX each time, so there's no error
+	//building up across the row - and the SIMD kernels get exactly the same 
+	//weights, doing the same sums a few pixels at a time.
+	inline float At(int pixel) const {
+		return rowStart + ((float)pixel * stepX);
+	}
+
+	float stepX;	//Change in weight for each pixel along a row
+	float stepY;	//Change in weight for each row down
+	float rowStart;	//Weight at the first pixel of the current row
+};
+
+/*
+A vertex that's been transformed into clip space, but not yet divided by w.
+Triangles are clipped in this form, so the attributes can be interpolated
+linearly across the new edges.
+*/
+struct ClipVertex {
+	Vector4 position;
+	Colour	colour;
+	Vector2 texCoord;
+};
+
+/*
+A clip space vertex, after the divide by w. Indexed meshes share vertices
+between triangles, so each is only projected once per draw, rather than once
+for every triangle that uses it. The outcode has a bit set for each clipping
+plane the vertex is outside of - if it's not 0, the vertex has to go through
+ClipTriangle instead, and position and texCoord are left unset.
+*/
+struct ProjectedVertex {
+	Vector4 position;
+	Vector3	texCoord;	//Divided by w, ready for perspective correction
+	int		outcode;
+};
+
+//Number of planes a triangle may actually be cut by - the near plane, plus
+//the 4 guard band planes.
+static const int NUM_CLIP_PLANES = 5;
+
+//Each plane clipped against can add at most one vertex to a triangle
+static const int MAX_CLIP_VERTICES = 3 + NUM_CLIP_PLANES;
+
+//How far out past the edges of the screen the guard band planes are, in NDC.
+//Triangles only get clipped at the sides if they cross these.
+static const float CLIP_GUARD_BAND = 16.0f;
+
+/*
+A triangle that's been through the viewport transform, and is waiting in the 
+tile bins to be rasterised. It carries everything RasteriseTri needs, as by the
+time the tiles are filled, DrawObject may well have moved onto another object.
+*/
+struct ScreenTriangle {
+	Vector4		v[3];
+	Colour		colours[3];
+	Vector3		texCoords[3];
+	Texture*	texture;
+	float		areaRecip;
+
+	//How much the perspective divided texture coordinates change for each
+	//pixel across, and each row down, with u and v already scaled up into 
+	//texels - used to pick which mip level each pixel samples from.
+	Vector3		texGradientX;
+	Vector3		texGradientY;
+
+	unsigned short	minDepth;	//Nearest depth of any vertex, for early rejection
+	DepthFunction	depthFunction;
+	bool			depthWrite;
+	TextureFilter	textureFilter;
+
+	int minX, minY;	//Integer pixel bounds, clamped to the screen.
+	int maxX, maxY;	//The max bounds are exclusive.
+
+	bool	subPixel;	//Rasterise using the fixed point positions below
+	int		fixedX[3];	//Vertex positions snapped to the sub pixel grid
+	int		fixedY[3];
+};
+
+/*
+The screen is split up into a grid of these. Each one owns its own rectangle
+of the colour and depth buffers, so the tiles can be filled in parallel without
+any locking - no two threads will ever write to the same pixel.
+*/
+struct RasterTile {
+	int minX, minY;
+	int maxX, maxY;
+
+	unsigned short maxDepth;	//Furthest depth of any hiZ block in the tile
+
+	vector<uint> triangles;	//Indices into the screen triangle list
+};
+
+//Width and height of a RasterTile, in pixels
+static const int RASTER_TILE_SIZE = 64;
+
+/*
+Width and height of the blocks in the hierarchical z buffer, in pixels. Each
+block keeps the furthest depth of any of its pixels, so a triangle that's
+behind that can be skipped without looking at a single pixel. Must divide
+RASTER_TILE_SIZE, so that no block is ever shared between two tiles.
+*/
+static const int HIZ_BLOCK_SIZE = 8;
+
+//Fractional bits vertex positions are snapped to in PRECISION_SUBPIXEL - so
+//there's 256 steps between each pixel centre.
+static const int SUBPIXEL_BITS	= 8;
+static const int SUBPIXEL_SCALE	= 1 << SUBPIXEL_BITS;
+
+//The portMatrix scales z to fill the range of our 16 bit depth buffer
+static const float MAX_DEPTH = 65535.0f;
 
-class RenderObject;
-class Texture;
 
-class SoftwareRasteriser : public Window	{
+class SoftwareRasteriser	{
 public:
-	SoftwareRasteriser(uint width, uint height);
+	//numThreads is how many workers help fill the screen tiles - see ThreadPool.
+	//If you're running lots of rasterisers at once, 0 keeps each one to the
+	//thread that's using it.
+	SoftwareRasteriser(RenderTarget &renderTarget, int numThreads = -1);
 
 	~SoftwareRasteriser(void);
 
-	void	SoftwareRasteriser::RasteriseLineLoops(RenderObject*o);
+	void	RasteriseLineLoops(RenderObject*o);
 
 
 	void	DrawObject(RenderObject*o);
@@ -60,6 +232,56 @@ public:
 		viewProjMatrix		= projectionMatrix * viewMatrix;
 	}
 
+	const Matrix4&	GetViewMatrix() const {
+		return viewMatrix;
+	}
+
+	const Matrix4&	GetViewProjectionMatrix() const {
+		return viewProjMatrix;
+	}
+
+	//Sets how triangle depths are compared against the depth buffer.
+	//Analogous to glDepthFunc - defaults to DEPTH_LESS_EQUAL
+	void	SetDepthFunction(DepthFunction f) {
+		depthFunction = f;
+	}
+
+	//Enables or disables writing to the depth buffer. Analogous to glDepthMask
+	void	SetDepthMask(bool write) {
+		depthWrite = write;
+	}
+
+	//Sets how textured triangles are sampled - defaults to FILTER_NEAREST
+	void	SetTextureFilter(TextureFilter f) {
+		textureFilter = f;
+	}
+
+	TextureFilter GetTextureFilter() const {
+		return textureFilter;
+	}
+
+	//Picks the pixel kernel used to fill triangles. The fastest one the CPU 
+	//supports is chosen on construction - returns false if the CPU can't run
+	//the requested kernel, in which case the current one is kept.
+	bool	SetRasteriserKernel(RasteriserKernel k);
+
+	RasteriserKernel GetRasteriserKernel() const {
+		return rasteriserKernel;
+	}
+
+	//PRECISION_SUBPIXEL snaps vertices to a 1/256th pixel grid and samples at
+	//pixel centres, with the top-left fill rule deciding who owns pixels that
+	//lie exactly on an edge - so triangles sharing an edge never leave cracks, 
+	//or both fill the same pixel, and the output is bit exact no matter how 
+	//the tiles get split between threads. It only has a scalar kernel, though!
+	void	SetRasteriserPrecision(RasteriserPrecision p) {
+		rasteriserPrecision = p;
+	}
+
+	RasteriserPrecision GetRasteriserPrecision() const {
+		return rasteriserPrecision;
+	}
+
 	BoundingBox CalculateBoxForTri(const Vector4 &a, const Vector4 &b, const Vector4 &c);
 
 	static float ScreenAreaOfTri(const Vector4 &v0,
@@ -68,12 +290,30 @@ public:
 
 protected:
 	Texture* currentTexture;
+	CullMode currentCullMode;
 	Colour*	GetCurrentBuffer();
 
+	//Transforms the object's vertices into clip space. The returned array is
+	//only valid until the next object is transformed - it's NULL if the mesh
+	//has no vertices, so there's nothing to draw.
+	const Vector4*	TransformMesh(RenderObject*o);
+
 	void	RasterisePointsMesh(RenderObject*o);
 	void	RasteriseLinesMesh(RenderObject*o);
 
-	virtual void Resize();
+	//Picks up the render target's buffers again, if they've been reallocated
+	inline void CheckTargetSize() {
+		if (target->GetBufferGeneration() != targetGeneration) {
+			Resize();
+		}
+	}
+	void	Resize();
+
+	void	BuildPortMatrices();
+
+	void	BuildTiles();
+	void	FlushTriangles();
+	void	RasteriseTile(RasterTile &tile);
 
 	void	RasteriseLine(const Vector4 &v0, const Vector4 &v1, 
 		const Colour &colA = Colour(255,255,255,255), const Colour &colB = Colour(255,255,255,255), 
@@ -95,17 +335,83 @@ protected:
 
 
 	void	RasteriseTriMesh(RenderObject*o);
+	void	ProjectVertices(const Mesh* m, const Vector4* clipVertices);
 
+	uint	ClipTriangle(const ClipVertex* in, ClipVertex* out);
+	void	RasteriseClipSpaceTri(const ClipVertex &a, const ClipVertex &b, const ClipVertex &c);
+
+	//Transforms a triangle into screen space, and bins it into the tiles it covers.
+	//Nothing is actually drawn until FlushTriangles is called.
 	void	RasteriseTri(const Vector4 &v0, const Vector4 &v1, const Vector4 &v2, 
 		const Colour &c0 = Colour(), const Colour &c1 = Colour(), const Colour &c2= Colour(),
 		const Vector3 &t0 = Vector3(), const Vector3 &t1= Vector3(), const Vector3 &t2	= Vector3());
+
+	void	RasteriseTri(const ScreenTriangle &tri, RasterTile &tile);
+	bool	RasteriseTriRect(const ScreenTriangle &tri, int minX, int minY, int maxX, int maxY);
+	bool	RasteriseTriRectScalar(const ScreenTriangle &tri, int minX, int minY, int maxX, int maxY);
+	bool	RasteriseTriRectSSE41(const ScreenTriangle &tri, int minX, int minY, int maxX, int maxY);
+	bool	RasteriseTriRectAVX2(const ScreenTriangle &tri, int minX, int minY, int maxX, int maxY);
+	bool	RasteriseTriRectSubPixel(const ScreenTriangle &tri, int minX, int minY, int maxX, int maxY);
+
+	//Depth tests a single pixel of a triangle, and shades it if it passes, using
+	//the barycentric weights at that pixel. Returns true if depth was written.
+	bool	ShadeTriPixel(const ScreenTriangle &tri, int x, int y, float alpha, float beta, float gamma);
+
+	void			BuildHiZ();
+	unsigned short	CalculateBlockMaxDepth(int blockX, int blockY);
+
+	//Returns true if nothing drawn at minDepth or further away can pass the depth
+	//test against a region whose furthest stored depth is maxDepth
+	static inline bool DepthOccluded(DepthFunction f, unsigned short minDepth, unsigned short maxDepth) {
+		switch (f) {
+		case DEPTH_LESS:		return minDepth >= maxDepth;
+		case DEPTH_LESS_EQUAL:	return minDepth >  maxDepth;
+		case DEPTH_NEVER:		return true;
+		default:				return false;	//The rest can always pass somewhere
+		}
+	}
+
+	static inline bool DepthTest(DepthFunction f, unsigned short incoming, unsigned short stored) {
+		switch (f) {
+		case DEPTH_NEVER:			return false;
+		case DEPTH_LESS:			return incoming <  stored;
+		case DEPTH_EQUAL:			return incoming == stored;
+		case DEPTH_LESS_EQUAL:		return incoming <= stored;
+		case DEPTH_GREATER:			return incoming >  stored;
+		case DEPTH_NOT_EQUAL:		return incoming != stored;
+		case DEPTH_GREATER_EQUAL:	return incoming >= stored;
+		default:					return true;	//DEPTH_ALWAYS
+		}
+	}
 	
+	RenderTarget*	target;
+	uint			targetGeneration;
+	uint			screenWidth;
+	uint			screenHeight;
+
 	int		currentDrawBuffer;
+
+	vector<Vector4>			transformedVertices;
+	vector<ProjectedVertex>	projectedVertices;
+	vector<ScreenTriangle>	screenTriangles;
+	vector<RasterTile>		tiles;
+	int						tilesX;
+	int						tilesY;
+
+	ThreadPool				threadPool;
+	RasteriserKernel		rasteriserKernel;
+	RasteriserPrecision		rasteriserPrecision;
 	
 
 	Colour*	buffers[2];
 
 	unsigned short*	depthBuffer;
+	unsigned short*	hiZBuffer;
+	int				hiZWidth;
+	int				hiZHeight;
+	DepthFunction	depthFunction;
+	bool			depthWrite;
+	TextureFilter	textureFilter;
 
 	Matrix4 viewMatrix;
 	Matrix4 projectionMatrix;
@@ -114,6 +420,7 @@ protected:
 	Matrix4	viewProjMatrix;
 
 	Matrix4	portMatrix;
+	Matrix4	subPixelPortMatrix;	//Maps onto pixel edges rather than centres
 
 
 };
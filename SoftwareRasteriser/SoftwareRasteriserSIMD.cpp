@@ -0,0 +1,766 @@
+#include "SoftwareRasteriser.h"
+#include "CPUFeatures.h"
+
+#include <immintrin.h>
+#include <cstring>
+
+/*
+These are the SIMD versions of RasteriseTriRect. Rather than a pixel at a time,
+they work on a run of 4 (SSE4.1) or 8 (AVX2) pixels along a row at once - the
+coverage test, barycentrics, depth test and colour / texture coordinate
+interpolation are all done for every pixel in the run in one go, and a lane mask
+then decides which of the pixels actually get written.
+
+The maths is done in the same order as the scalar kernel, with the same
+truncations - including working out each pixel's barycentrics from the start
+of its row, with EdgeEquation::At - so the depths and colours come out exactly
+the same, whichever texture filter is used.
+
+Only the pixels inside [minX, maxX) are ever read or written - the pixels either
+side may well belong to another tile, and so to another thread!
+*/
+
+/*
+Everything the samplers need to know about a texture's mip chain, pulled out
+once per triangle. The level sizes are ints so the AVX2 sampler can gather
+them, as every lane can end up on a different level. Compressed textures have
+no texels to gather from, so each lane instead fetches its texels through the
+texture, and so through the thread's decoded block cache.
+*/
+struct MipChain {
+	const Texture*	texture;
+	bool			compressed;
+	const Colour*	texels;
+	const int*		widths;
+	const int*		heights;
+	const int*		offsets;
+	const int*		pitches;
+	TexelLayout		layout;
+	int				maxLevel;
+	float			width;		//Size of level 0, as the gradients are scaled by it
+	float			height;
+	TextureFilter	filter;
+};
+
+TARGET_SSE41 static inline __m128i DepthTestSSE41(DepthFunction f, __m128i incoming, __m128i stored) {
+	__m128i allSet = _mm_set1_epi32(-1);
+
+	switch (f) {
+	case DEPTH_NEVER:			return _mm_setzero_si128();
+	case DEPTH_LESS:			return _mm_cmplt_epi32(incoming, stored);
+	case DEPTH_EQUAL:			return _mm_cmpeq_epi32(incoming, stored);
+	case DEPTH_LESS_EQUAL:		return _mm_xor_si128(_mm_cmpgt_epi32(incoming, stored), allSet);
+	case DEPTH_GREATER:			return _mm_cmpgt_epi32(incoming, stored);
+	case DEPTH_NOT_EQUAL:		return _mm_xor_si128(_mm_cmpeq_epi32(incoming, stored), allSet);
+	case DEPTH_GREATER_EQUAL:	return _mm_xor_si128(_mm_cmplt_epi32(incoming, stored), allSet);
+	default:					return allSet;	//DEPTH_ALWAYS
+	}
+}
+
+/*
+Colour * float truncates each channel back to a byte, and Colour + Colour wraps
+around, so we do the same here - a channel at a time, 4 pixels at once.
+*/
+TARGET_SSE41 static inline __m128i InterpolateColourSSE41(const __m128 channels[3][4], __m128 alpha, __m128 beta, __m128 gamma) {
+	__m128i result		= _mm_setzero_si128();
+	__m128i byteMask	= _mm_set1_epi32(0xFF);
+
+	for (int i = 0; i < 4; ++i) {
+		__m128i sum = _mm_add_epi32(_mm_add_epi32(
+			_mm_cvttps_epi32(_mm_mul_ps(channels[0][i], alpha)),
+			_mm_cvttps_epi32(_mm_mul_ps(channels[1][i], beta))),
+			_mm_cvttps_epi32(_mm_mul_ps(channels[2][i], gamma)));
+
+		result = _mm_or_si128(result, _mm_sll_epi32(_mm_and_si128(sum, byteMask), _mm_cvtsi32_si128(i * 8)));
+	}
+	return result;
+}
+
+//Same as MipFootprint, for 4 pixels at once
+TARGET_SSE41 static inline __m128 MipFootprintSSE41(const MipChain &chain, const __m128 texGradients[2][3], __m128 u, __m128 v, __m128 w) {
+	__m128 texelU = _mm_mul_ps(u, _mm_set1_ps(chain.width));
+	__m128 texelV = _mm_mul_ps(v, _mm_set1_ps(chain.height));
+
+	__m128 dudx = _mm_sub_ps(texGradients[0][0], _mm_mul_ps(texelU, texGradients[0][2]));
+	__m128 dvdx = _mm_sub_ps(texGradients[0][1], _mm_mul_ps(texelV, texGradients[0][2]));
+	__m128 dudy = _mm_sub_ps(texGradients[1][0], _mm_mul_ps(texelU, texGradients[1][2]));
+	__m128 dvdy = _mm_sub_ps(texGradients[1][1], _mm_mul_ps(texelV, texGradients[1][2]));
+
+	__m128 lengthX = _mm_add_ps(_mm_mul_ps(dudx, dudx), _mm_mul_ps(dvdx, dvdx));
+	__m128 lengthY = _mm_add_ps(_mm_mul_ps(dudy, dudy), _mm_mul_ps(dvdy, dvdy));
+
+	return _mm_div_ps(_mm_max_ps(lengthX, lengthY), _mm_mul_ps(w, w));
+}
+
+//Same as SelectMipLevel
+TARGET_SSE41 static inline __m128i MipLevelSSE41(const MipChain &chain, __m128 footprint) {
+	__m128i exponent	= _mm_and_si128(_mm_srli_epi32(_mm_castps_si128(footprint), 23), _mm_set1_epi32(0xFF));
+	__m128i level		= _mm_srai_epi32(_mm_sub_epi32(exponent, _mm_set1_epi32(126)), 1);
+
+	return _mm_max_epi32(_mm_setzero_si128(), _mm_min_epi32(level, _mm_set1_epi32(chain.maxLevel)));
+}
+
+//Same as SelectMipLOD
+TARGET_SSE41 static inline __m128 MipLODSSE41(const MipChain &chain, __m128 footprint) {
+	__m128 lod = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(footprint)), _mm_set1_ps(1.0f / 8388608.0f)), _mm_set1_ps(127.0f)), _mm_set1_ps(0.5f));
+
+	return _mm_max_ps(_mm_setzero_ps(), _mm_min_ps(lod, _mm_set1_ps((float)chain.maxLevel)));
+}
+
+/*
+Same as Texture::LerpTexels, for 4 texels at once. Each texel's channels are
+unpacked to 16 bits, and its weight copied out to all 4 of them, so 2 texels
+fit in a register at a time.
+*/
+TARGET_SSE41 static inline __m128i LerpTexelsSSE41(__m128i a, __m128i b, __m128i weight) {
+	__m128i zero		= _mm_setzero_si128();
+	__m128i weightB		= _mm_or_si128(weight, _mm_slli_epi32(weight, 16));
+	__m128i weightA		= _mm_sub_epi16(_mm_set1_epi16(256), weightB);
+	__m128i rounding	= _mm_set1_epi16(128);
+
+	__m128i low = _mm_add_epi16(_mm_add_epi16(
+		_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi32(weightA, weightA)),
+		_mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi32(weightB, weightB))), rounding);
+
+	__m128i high = _mm_add_epi16(_mm_add_epi16(
+		_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi32(weightA, weightA)),
+		_mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi32(weightB, weightB))), rounding);
+
+	return _mm_packus_epi16(_mm_srli_epi16(low, 8), _mm_srli_epi16(high, 8));
+}
+
+//Same as Texture::SwizzleTexel, for 4 texels at once
+TARGET_SSE41 static inline __m128i SwizzleTexelsSSE41(TexelLayout layout, __m128i pitch, __m128i x, __m128i y) {
+	if (layout == TEXELS_TILED) {
+		__m128i inTile	= _mm_set1_epi32(TEXEL_TILE_SIZE - 1);
+		__m128i tile	= _mm_add_epi32(_mm_mullo_epi32(_mm_srai_epi32(y, TEXEL_TILE_BITS), pitch), _mm_srai_epi32(x, TEXEL_TILE_BITS));
+
+		return _mm_add_epi32(_mm_slli_epi32(tile, TEXEL_TILE_BITS * 2),
+			_mm_add_epi32(_mm_slli_epi32(_mm_and_si128(y, inTile), TEXEL_TILE_BITS), _mm_and_si128(x, inTile)));
+	}
+	return _mm_add_epi32(_mm_mullo_epi32(y, pitch), x);
+}
+
+//Same as Texture::NearestTextSample, for 4 pixels at once
+TARGET_SSE41 static inline __m128i NearestSampleSSE41(const MipChain &chain, __m128 u, __m128 v, __m128i level, int laneMask) {
+	float	laneU[4];
+	float	laneV[4];
+	int		laneLevel[4];
+	_mm_storeu_ps(laneU, u);
+	_mm_storeu_ps(laneV, v);
+	_mm_storeu_si128((__m128i*)laneLevel, level);
+
+	//There's no gather in SSE, so with a level per lane, the lookup may as
+	//well all be done a lane at a time
+	unsigned int samples[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < 4; ++i) {
+		if (laneMask & (1 << i)) {
+			int width	= chain.widths[laneLevel[i]];
+			int height	= chain.heights[laneLevel[i]];
+
+			int x = (int)(laneU[i] * (width  - 1));
+			int y = (int)(laneV[i] * (height - 1));
+
+			x = max(0, min(x, width  - 1));
+			y = max(0, min(y, height - 1));
+
+			if (chain.compressed) {
+				samples[i] = chain.texture->ColourAtPoint(x, y, laneLevel[i]).c;
+			}
+			else {
+				samples[i] = chain.texels[chain.offsets[laneLevel[i]] + Texture::SwizzleTexel(chain.layout, chain.pitches[laneLevel[i]], x, y)].c;
+			}
+		}
+	}
+	return _mm_loadu_si128((__m128i*)samples);
+}
+
+//Same as Texture::BilinearTextSample, for 4 pixels at once
+TARGET_SSE41 static inline __m128i BilinearSampleSSE41(const MipChain &chain, __m128 u, __m128 v, __m128i level, int laneMask) {
+	int laneLevel[4];
+	_mm_storeu_si128((__m128i*)laneLevel, level);
+
+	__m128i width	= _mm_set_epi32(chain.widths[laneLevel[3]],  chain.widths[laneLevel[2]],  chain.widths[laneLevel[1]],  chain.widths[laneLevel[0]]);
+	__m128i height	= _mm_set_epi32(chain.heights[laneLevel[3]], chain.heights[laneLevel[2]], chain.heights[laneLevel[1]], chain.heights[laneLevel[0]]);
+	__m128i offset	= _mm_set_epi32(chain.offsets[laneLevel[3]], chain.offsets[laneLevel[2]], chain.offsets[laneLevel[1]], chain.offsets[laneLevel[0]]);
+	__m128i pitch	= _mm_set_epi32(chain.pitches[laneLevel[3]], chain.pitches[laneLevel[2]], chain.pitches[laneLevel[1]], chain.pitches[laneLevel[0]]);
+
+	__m128i one		= _mm_set1_epi32(1);
+	__m128i zero	= _mm_setzero_si128();
+	__m128i maxX	= _mm_sub_epi32(width,  one);
+	__m128i maxY	= _mm_sub_epi32(height, one);
+
+	__m128 x		= _mm_mul_ps(u, _mm_cvtepi32_ps(maxX));
+	__m128 y		= _mm_mul_ps(v, _mm_cvtepi32_ps(maxY));
+	__m128 floorX	= _mm_floor_ps(x);
+	__m128 floorY	= _mm_floor_ps(y);
+
+	__m128i weightX = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(x, floorX), _mm_set1_ps(256.0f)));
+	__m128i weightY = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(y, floorY), _mm_set1_ps(256.0f)));
+
+	__m128i x0 = _mm_cvttps_epi32(floorX);
+	__m128i y0 = _mm_cvttps_epi32(floorY);
+	__m128i x1 = _mm_max_epi32(zero, _mm_min_epi32(_mm_add_epi32(x0, one), maxX));
+	__m128i y1 = _mm_max_epi32(zero, _mm_min_epi32(_mm_add_epi32(y0, one), maxY));
+	x0 = _mm_max_epi32(zero, _mm_min_epi32(x0, maxX));
+	y0 = _mm_max_epi32(zero, _mm_min_epi32(y0, maxY));
+
+	unsigned int texels[4][4];
+	memset(texels, 0, sizeof(texels));
+
+	if (chain.compressed) {
+		int tapX[2][4];
+		int tapY[2][4];
+		_mm_storeu_si128((__m128i*)tapX[0], x0);
+		_mm_storeu_si128((__m128i*)tapX[1], x1);
+		_mm_storeu_si128((__m128i*)tapY[0], y0);
+		_mm_storeu_si128((__m128i*)tapY[1], y1);
+
+		for (int i = 0; i < 4; ++i) {
+			if (laneMask & (1 << i)) {
+				for (int j = 0; j < 4; ++j) {
+					texels[j][i] = chain.texture->ColourAtPoint(tapX[j & 1][i], tapY[j >> 1][i], laneLevel[i]).c;
+				}
+			}
+		}
+	}
+	else {
+		int index[4][4];
+		_mm_storeu_si128((__m128i*)index[0], _mm_add_epi32(offset, SwizzleTexelsSSE41(chain.layout, pitch, x0, y0)));
+		_mm_storeu_si128((__m128i*)index[1], _mm_add_epi32(offset, SwizzleTexelsSSE41(chain.layout, pitch, x1, y0)));
+		_mm_storeu_si128((__m128i*)index[2], _mm_add_epi32(offset, SwizzleTexelsSSE41(chain.layout, pitch, x0, y1)));
+		_mm_storeu_si128((__m128i*)index[3], _mm_add_epi32(offset, SwizzleTexelsSSE41(chain.layout, pitch, x1, y1)));
+
+		for (int i = 0; i < 4; ++i) {
+			if (laneMask & (1 << i)) {
+				for (int j = 0; j < 4; ++j) {
+					texels[j][i] = chain.texels[index[j][i]].c;
+				}
+			}
+		}
+	}
+
+	__m128i top		= LerpTexelsSSE41(_mm_loadu_si128((__m128i*)texels[0]), _mm_loadu_si128((__m128i*)texels[1]), weightX);
+	__m128i bottom	= LerpTexelsSSE41(_mm_loadu_si128((__m128i*)texels[2]), _mm_loadu_si128((__m128i*)texels[3]), weightX);
+
+	return LerpTexelsSSE41(top, bottom, weightY);
+}
+
+TARGET_SSE41 static inline __m128i SampleTextureSSE41(const MipChain &chain, const __m128 texCoords[3][3], const __m128 texGradients[2][3], __m128 alpha, __m128 beta, __m128 gamma, int laneMask) {
+	__m128 u = _mm_add_ps(_mm_add_ps(_mm_mul_ps(texCoords[0][0], alpha), _mm_mul_ps(texCoords[1][0], beta)), _mm_mul_ps(texCoords[2][0], gamma));
+	__m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(texCoords[0][1], alpha), _mm_mul_ps(texCoords[1][1], beta)), _mm_mul_ps(texCoords[2][1], gamma));
+	__m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(texCoords[0][2], alpha), _mm_mul_ps(texCoords[1][2], beta)), _mm_mul_ps(texCoords[2][2], gamma));
+
+	u = _mm_div_ps(u, w);
+	v = _mm_div_ps(v, w);
+
+	__m128 footprint = MipFootprintSSE41(chain, texGradients, u, v, w);
+
+	switch (chain.filter) {
+	case FILTER_NEAREST:
+		break;	//Also what any unknown filter falls back to, below
+	case FILTER_BILINEAR:
+		return BilinearSampleSSE41(chain, u, v, MipLevelSSE41(chain, footprint), laneMask);
+	case FILTER_TRILINEAR: {
+		__m128	lod		= MipLODSSE41(chain, footprint);
+		__m128i level	= _mm_cvttps_epi32(lod);
+		__m128i weight	= _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(lod, _mm_cvtepi32_ps(level)), _mm_set1_ps(256.0f)));
+		__m128i next	= _mm_min_epi32(_mm_add_epi32(level, _mm_set1_epi32(1)), _mm_set1_epi32(chain.maxLevel));
+
+		return LerpTexelsSSE41(BilinearSampleSSE41(chain, u, v, level, laneMask), BilinearSampleSSE41(chain, u, v, next, laneMask), weight);
+	}
+	}
+	return NearestSampleSSE41(chain, u, v, MipLevelSSE41(chain, footprint), laneMask);
+}
+
+TARGET_SSE41 bool SoftwareRasteriser::RasteriseTriRectSSE41(const ScreenTriangle &tri, int minX, int minY, int maxX, int maxY) {
+	bool depthWritten = false;
+
+	Vector2 origin((float)minX, (float)minY);
+
+	EdgeEquation alphaEdge(tri.v[1], tri.v[2], origin, tri.areaRecip);
+	EdgeEquation betaEdge (tri.v[2], tri.v[0], origin, tri.areaRecip);
+	EdgeEquation gammaEdge(tri.v[0], tri.v[1], origin, tri.areaRecip);
+
+	__m128 lanes		= _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	__m128 zero			= _mm_setzero_ps();
+	__m128 maxDepth		= _mm_set1_ps(MAX_DEPTH);
+	__m128i laneIndex	= _mm_set_epi32(3, 2, 1, 0);
+
+	__m128 alphaStep	= _mm_set1_ps(alphaEdge.stepX);
+	__m128 betaStep		= _mm_set1_ps(betaEdge.stepX);
+	__m128 gammaStep	= _mm_set1_ps(gammaEdge.stepX);
+
+	__m128 z0 = _mm_set1_ps(tri.v[0].z);
+	__m128 z1 = _mm_set1_ps(tri.v[1].z);
+	__m128 z2 = _mm_set1_ps(tri.v[2].z);
+
+	__m128 channels[3][4];
+	__m128 texCoords[3][3];
+	__m128 texGradients[2][3];
+	memset(texGradients, 0, sizeof(texGradients));	//Only filled in for textured triangles
+	for (int i = 0; i < 3; ++i) {
+		for (int c = 0; c < 4; ++c) {
+			channels[i][c] = _mm_set1_ps((float)((tri.colours[i].c >> (c * 8)) & 0xFF));
+		}
+		texCoords[i][0] = _mm_set1_ps(tri.texCoords[i].x);
+		texCoords[i][1] = _mm_set1_ps(tri.texCoords[i].y);
+		texCoords[i][2] = _mm_set1_ps(tri.texCoords[i].z);
+	}
+
+	MipChain chain;
+	if (tri.texture) {
+		const Texture* t = tri.texture;
+
+		chain.texture		= t;
+		chain.compressed	= t->IsCompressed();
+		chain.texels		= t->texels;
+		chain.widths		= t->mipWidths;
+		chain.heights		= t->mipHeights;
+		chain.offsets		= t->mipOffsets;
+		chain.pitches		= t->mipPitches;
+		chain.layout		= t->layout;
+		chain.maxLevel		= (int)t->numMipLevels - 1;
+		chain.width			= (float)t->width;
+		chain.height		= (float)t->height;
+		chain.filter		= tri.textureFilter;
+
+		const Vector3* gradients[2] = { &tri.texGradientX, &tri.texGradientY };
+		for (int i = 0; i < 2; ++i) {
+			texGradients[i][0] = _mm_set1_ps(gradients[i]->x);
+			texGradients[i][1] = _mm_set1_ps(gradients[i]->y);
+			texGradients[i][2] = _mm_set1_ps(gradients[i]->z);
+		}
+	}
+
+	for (int y = minY; y < maxY; ++y) {
+		__m128 alphaRow	= _mm_set1_ps(alphaEdge.rowStart);
+		__m128 betaRow	= _mm_set1_ps(betaEdge.rowStart);
+		__m128 gammaRow	= _mm_set1_ps(gammaEdge.rowStart);
+
+		unsigned short* depthRow	= &depthBuffer[y * screenWidth];
+		Colour*			colourRow	= &buffers[currentDrawBuffer][y * screenWidth];
+
+		for (int x = minX; x < maxX; x += 4) {
+			int		count	= min(4, maxX - x);
+			bool	full	= (count == 4);
+
+			//Same sums as EdgeEquation::At
+			__m128 offset	= _mm_add_ps(_mm_set1_ps((float)(x - minX)), lanes);
+			__m128 alpha	= _mm_add_ps(alphaRow, _mm_mul_ps(offset, alphaStep));
+			__m128 beta		= _mm_add_ps(betaRow,  _mm_mul_ps(offset, betaStep));
+			__m128 gamma	= _mm_add_ps(gammaRow, _mm_mul_ps(offset, gammaStep));
+
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(alpha, zero), _mm_cmpge_ps(beta, zero)), _mm_cmpge_ps(gamma, zero));
+			inside = _mm_and_ps(inside, _mm_castsi128_ps(_mm_cmplt_epi32(laneIndex, _mm_set1_epi32(count))));
+
+			if (_mm_movemask_ps(inside) == 0) {
+				continue;
+			}
+
+			__m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(z0, alpha), _mm_mul_ps(z1, beta)), _mm_mul_ps(z2, gamma));
+			inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(z, zero), _mm_cmple_ps(z, maxDepth)));
+
+			__m128i depth = _mm_cvttps_epi32(z);
+			__m128i stored;
+
+			if (full) {
+				stored = _mm_cvtepu16_epi32(_mm_loadl_epi64((__m128i*)&depthRow[x]));
+			}
+			else {
+				int partial[4] = { 0, 0, 0, 0 };
+				for (int i = 0; i < count; ++i) {
+					partial[i] = depthRow[x + i];
+				}
+				stored = _mm_loadu_si128((__m128i*)partial);
+			}
+
+			__m128i pass = _mm_and_si128(_mm_castps_si128(inside), DepthTestSSE41(tri.depthFunction, depth, stored));
+			int		mask = _mm_movemask_ps(_mm_castsi128_ps(pass));
+
+			if (mask == 0) {
+				continue;
+			}
+
+			if (tri.depthWrite) {
+				__m128i newDepth = _mm_blendv_epi8(stored, depth, pass);
+
+				if (full) {
+					_mm_storel_epi64((__m128i*)&depthRow[x], _mm_packus_epi32(newDepth, newDepth));
+				}
+				else {
+					int partial[4];
+					_mm_storeu_si128((__m128i*)partial, newDepth);
+					for (int i = 0; i < count; ++i) {
+						depthRow[x + i] = (unsigned short)partial[i];
+					}
+				}
+				depthWritten = true;
+			}
+
+			__m128i colours = tri.texture ?
+				SampleTextureSSE41(chain, texCoords, texGradients, alpha, beta, gamma, mask) :
+				InterpolateColourSSE41(channels, alpha, beta, gamma);
+
+			if (full) {
+				__m128i existing = _mm_loadu_si128((__m128i*)&colourRow[x]);
+				_mm_storeu_si128((__m128i*)&colourRow[x], _mm_blendv_epi8(existing, colours, pass));
+			}
+			else {
+				unsigned int partial[4];
+				_mm_storeu_si128((__m128i*)partial, colours);
+				for (int i = 0; i < count; ++i) {
+					if (mask & (1 << i)) {
+						colourRow[x + i].c = partial[i];
+					}
+				}
+			}
+		}
+		alphaEdge.NextRow();
+		betaEdge.NextRow();
+		gammaEdge.NextRow();
+	}
+	return depthWritten;
+}
+
+TARGET_AVX2 static inline __m256i DepthTestAVX2(DepthFunction f, __m256i incoming, __m256i stored) {
+	__m256i allSet = _mm256_set1_epi32(-1);
+
+	switch (f) {
+	case DEPTH_NEVER:			return _mm256_setzero_si256();
+	case DEPTH_LESS:			return _mm256_cmpgt_epi32(stored, incoming);
+	case DEPTH_EQUAL:			return _mm256_cmpeq_epi32(incoming, stored);
+	case DEPTH_LESS_EQUAL:		return _mm256_xor_si256(_mm256_cmpgt_epi32(incoming, stored), allSet);
+	case DEPTH_GREATER:			return _mm256_cmpgt_epi32(incoming, stored);
+	case DEPTH_NOT_EQUAL:		return _mm256_xor_si256(_mm256_cmpeq_epi32(incoming, stored), allSet);
+	case DEPTH_GREATER_EQUAL:	return _mm256_xor_si256(_mm256_cmpgt_epi32(stored, incoming), allSet);
+	default:					return allSet;	//DEPTH_ALWAYS
+	}
+}
+
+TARGET_AVX2 static inline __m256i InterpolateColourAVX2(const __m256 channels[3][4], __m256 alpha, __m256 beta, __m256 gamma) {
+	__m256i result		= _mm256_setzero_si256();
+	__m256i byteMask	= _mm256_set1_epi32(0xFF);
+
+	for (int i = 0; i < 4; ++i) {
+		__m256i sum = _mm256_add_epi32(_mm256_add_epi32(
+			_mm256_cvttps_epi32(_mm256_mul_ps(channels[0][i], alpha)),
+			_mm256_cvttps_epi32(_mm256_mul_ps(channels[1][i], beta))),
+			_mm256_cvttps_epi32(_mm256_mul_ps(channels[2][i], gamma)));
+
+		result = _mm256_or_si256(result, _mm256_sll_epi32(_mm256_and_si256(sum, byteMask), _mm_cvtsi32_si128(i * 8)));
+	}
+	return result;
+}
+
+TARGET_AVX2 static inline __m256 MipFootprintAVX2(const MipChain &chain, const __m256 texGradients[2][3], __m256 u, __m256 v, __m256 w) {
+	__m256 texelU = _mm256_mul_ps(u, _mm256_set1_ps(chain.width));
+	__m256 texelV = _mm256_mul_ps(v, _mm256_set1_ps(chain.height));
+
+	__m256 dudx = _mm256_sub_ps(texGradients[0][0], _mm256_mul_ps(texelU, texGradients[0][2]));
+	__m256 dvdx = _mm256_sub_ps(texGradients[0][1], _mm256_mul_ps(texelV, texGradients[0][2]));
+	__m256 dudy = _mm256_sub_ps(texGradients[1][0], _mm256_mul_ps(texelU, texGradients[1][2]));
+	__m256 dvdy = _mm256_sub_ps(texGradients[1][1], _mm256_mul_ps(texelV, texGradients[1][2]));
+
+	__m256 lengthX = _mm256_add_ps(_mm256_mul_ps(dudx, dudx), _mm256_mul_ps(dvdx, dvdx));
+	__m256 lengthY = _mm256_add_ps(_mm256_mul_ps(dudy, dudy), _mm256_mul_ps(dvdy, dvdy));
+
+	return _mm256_div_ps(_mm256_max_ps(lengthX, lengthY), _mm256_mul_ps(w, w));
+}
+
+TARGET_AVX2 static inline __m256i MipLevelAVX2(const MipChain &chain, __m256 footprint) {
+	__m256i exponent	= _mm256_and_si256(_mm256_srli_epi32(_mm256_castps_si256(footprint), 23), _mm256_set1_epi32(0xFF));
+	__m256i level		= _mm256_srai_epi32(_mm256_sub_epi32(exponent, _mm256_set1_epi32(126)), 1);
+
+	return _mm256_max_epi32(_mm256_setzero_si256(), _mm256_min_epi32(level, _mm256_set1_epi32(chain.maxLevel)));
+}
+
+TARGET_AVX2 static inline __m256 MipLODAVX2(const MipChain &chain, __m256 footprint) {
+	__m256 lod = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_castps_si256(footprint)), _mm256_set1_ps(1.0f / 8388608.0f)), _mm256_set1_ps(127.0f)), _mm256_set1_ps(0.5f));
+
+	return _mm256_max_ps(_mm256_setzero_ps(), _mm256_min_ps(lod, _mm256_set1_ps((float)chain.maxLevel)));
+}
+
+//The unpacks and packs all work within each 128 bit half, so texels and their
+//weights stay lined up just as they do in LerpTexelsSSE41
+TARGET_AVX2 static inline __m256i LerpTexelsAVX2(__m256i a, __m256i b, __m256i weight) {
+	__m256i zero		= _mm256_setzero_si256();
+	__m256i weightB		= _mm256_or_si256(weight, _mm256_slli_epi32(weight, 16));
+	__m256i weightA		= _mm256_sub_epi16(_mm256_set1_epi16(256), weightB);
+	__m256i rounding	= _mm256_set1_epi16(128);
+
+	__m256i low = _mm256_add_epi16(_mm256_add_epi16(
+		_mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi32(weightA, weightA)),
+		_mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), _mm256_unpacklo_epi32(weightB, weightB))), rounding);
+
+	__m256i high = _mm256_add_epi16(_mm256_add_epi16(
+		_mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi32(weightA, weightA)),
+		_mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), _mm256_unpackhi_epi32(weightB, weightB))), rounding);
+
+	return _mm256_packus_epi16(_mm256_srli_epi16(low, 8), _mm256_srli_epi16(high, 8));
+}
+
+TARGET_AVX2 static inline __m256i SwizzleTexelsAVX2(TexelLayout layout, __m256i pitch, __m256i x, __m256i y) {
+	if (layout == TEXELS_TILED) {
+		__m256i inTile	= _mm256_set1_epi32(TEXEL_TILE_SIZE - 1);
+		__m256i tile	= _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(y, TEXEL_TILE_BITS), pitch), _mm256_srai_epi32(x, TEXEL_TILE_BITS));
+
+		return _mm256_add_epi32(_mm256_slli_epi32(tile, TEXEL_TILE_BITS * 2),
+			_mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(y, inTile), TEXEL_TILE_BITS), _mm256_and_si256(x, inTile)));
+	}
+	return _mm256_add_epi32(_mm256_mullo_epi32(y, pitch), x);
+}
+
+//Compressed textures can't be gathered from, so are fetched a lane at a time
+TARGET_AVX2 static inline __m256i FetchCompressedAVX2(const MipChain &chain, __m256i level, __m256i x, __m256i y, __m256i pass) {
+	int laneLevel[8];
+	int laneX[8];
+	int laneY[8];
+	_mm256_storeu_si256((__m256i*)laneLevel, level);
+	_mm256_storeu_si256((__m256i*)laneX, x);
+	_mm256_storeu_si256((__m256i*)laneY, y);
+
+	int laneMask = _mm256_movemask_ps(_mm256_castsi256_ps(pass));
+
+	unsigned int samples[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	for (int i = 0; i < 8; ++i) {
+		if (laneMask & (1 << i)) {
+			samples[i] = chain.texture->ColourAtPoint(laneX[i], laneY[i], laneLevel[i]).c;
+		}
+	}
+	return _mm256_loadu_si256((__m256i*)samples);
+}
+
+//The level is always clamped into the chain, so its sizes can be gathered for every lane
+TARGET_AVX2 static inline __m256i NearestSampleAVX2(const MipChain &chain, __m256 u, __m256 v, __m256i level, __m256i pass) {
+	__m256i one		= _mm256_set1_epi32(1);
+
+	__m256i maxX	= _mm256_sub_epi32(_mm256_i32gather_epi32(chain.widths,  level, 4), one);
+	__m256i maxY	= _mm256_sub_epi32(_mm256_i32gather_epi32(chain.heights, level, 4), one);
+	__m256i offset	= _mm256_i32gather_epi32(chain.offsets, level, 4);
+
+	__m256i x = _mm256_cvttps_epi32(_mm256_mul_ps(u, _mm256_cvtepi32_ps(maxX)));
+	__m256i y = _mm256_cvttps_epi32(_mm256_mul_ps(v, _mm256_cvtepi32_ps(maxY)));
+
+	x = _mm256_max_epi32(_mm256_setzero_si256(), _mm256_min_epi32(x, maxX));
+	y = _mm256_max_epi32(_mm256_setzero_si256(), _mm256_min_epi32(y, maxY));
+
+	if (chain.compressed) {
+		return FetchCompressedAVX2(chain, level, x, y, pass);
+	}
+
+	__m256i pitch	= _mm256_i32gather_epi32(chain.pitches, level, 4);
+	__m256i index	= _mm256_add_epi32(offset, SwizzleTexelsAVX2(chain.layout, pitch, x, y));
+
+	return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)chain.texels, index, pass, 4);
+}
+
+TARGET_AVX2 static inline __m256i BilinearSampleAVX2(const MipChain &chain, __m256 u, __m256 v, __m256i level, __m256i pass) {
+	__m256i one		= _mm256_set1_epi32(1);
+	__m256i zero	= _mm256_setzero_si256();
+
+	__m256i maxX	= _mm256_sub_epi32(_mm256_i32gather_epi32(chain.widths, level, 4), one);
+	__m256i maxY	= _mm256_sub_epi32(_mm256_i32gather_epi32(chain.heights, level, 4), one);
+	__m256i offset	= _mm256_i32gather_epi32(chain.offsets, level, 4);
+	__m256i pitch	= _mm256_i32gather_epi32(chain.pitches, level, 4);
+
+	__m256 x		= _mm256_mul_ps(u, _mm256_cvtepi32_ps(maxX));
+	__m256 y		= _mm256_mul_ps(v, _mm256_cvtepi32_ps(maxY));
+	__m256 floorX	= _mm256_floor_ps(x);
+	__m256 floorY	= _mm256_floor_ps(y);
+
+	__m256i weightX = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(x, floorX), _mm256_set1_ps(256.0f)));
+	__m256i weightY = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(y, floorY), _mm256_set1_ps(256.0f)));
+
+	__m256i x0 = _mm256_cvttps_epi32(floorX);
+	__m256i y0 = _mm256_cvttps_epi32(floorY);
+	__m256i x1 = _mm256_max_epi32(zero, _mm256_min_epi32(_mm256_add_epi32(x0, one), maxX));
+	__m256i y1 = _mm256_max_epi32(zero, _mm256_min_epi32(_mm256_add_epi32(y0, one), maxY));
+	x0 = _mm256_max_epi32(zero, _mm256_min_epi32(x0, maxX));
+	y0 = _mm256_max_epi32(zero, _mm256_min_epi32(y0, maxY));
+
+	if (chain.compressed) {
+		__m256i top		= LerpTexelsAVX2(FetchCompressedAVX2(chain, level, x0, y0, pass), FetchCompressedAVX2(chain, level, x1, y0, pass), weightX);
+		__m256i bottom	= LerpTexelsAVX2(FetchCompressedAVX2(chain, level, x0, y1, pass), FetchCompressedAVX2(chain, level, x1, y1, pass), weightX);
+
+		return LerpTexelsAVX2(top, bottom, weightY);
+	}
+
+	const int* texels = (const int*)chain.texels;
+
+	__m256i texel00 = _mm256_mask_i32gather_epi32(zero, texels, _mm256_add_epi32(offset, SwizzleTexelsAVX2(chain.layout, pitch, x0, y0)), pass, 4);
+	__m256i texel10 = _mm256_mask_i32gather_epi32(zero, texels, _mm256_add_epi32(offset, SwizzleTexelsAVX2(chain.layout, pitch, x1, y0)), pass, 4);
+	__m256i texel01 = _mm256_mask_i32gather_epi32(zero, texels, _mm256_add_epi32(offset, SwizzleTexelsAVX2(chain.layout, pitch, x0, y1)), pass, 4);
+	__m256i texel11 = _mm256_mask_i32gather_epi32(zero, texels, _mm256_add_epi32(offset, SwizzleTexelsAVX2(chain.layout, pitch, x1, y1)), pass, 4);
+
+	return LerpTexelsAVX2(LerpTexelsAVX2(texel00, texel10, weightX), LerpTexelsAVX2(texel01, texel11, weightX), weightY);
+}
+
+TARGET_AVX2 static inline __m256i SampleTextureAVX2(const MipChain &chain, const __m256 texCoords[3][3], const __m256 texGradients[2][3], __m256 alpha, __m256 beta, __m256 gamma, __m256i pass) {
+	__m256 u = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(texCoords[0][0], alpha), _mm256_mul_ps(texCoords[1][0], beta)), _mm256_mul_ps(texCoords[2][0], gamma));
+	__m256 v = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(texCoords[0][1], alpha), _mm256_mul_ps(texCoords[1][1], beta)), _mm256_mul_ps(texCoords[2][1], gamma));
+	__m256 w = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(texCoords[0][2], alpha), _mm256_mul_ps(texCoords[1][2], beta)), _mm256_mul_ps(texCoords[2][2], gamma));
+
+	u = _mm256_div_ps(u, w);
+	v = _mm256_div_ps(v, w);
+
+	__m256 footprint = MipFootprintAVX2(chain, texGradients, u, v, w);
+
+	switch (chain.filter) {
+	case FILTER_NEAREST:
+		break;	//Also what any unknown filter falls back to, below
+	case FILTER_BILINEAR:
+		return BilinearSampleAVX2(chain, u, v, MipLevelAVX2(chain, footprint), pass);
+	case FILTER_TRILINEAR: {
+		__m256	lod		= MipLODAVX2(chain, footprint);
+		__m256i level	= _mm256_cvttps_epi32(lod);
+		__m256i weight	= _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(lod, _mm256_cvtepi32_ps(level)), _mm256_set1_ps(256.0f)));
+		__m256i next	= _mm256_min_epi32(_mm256_add_epi32(level, _mm256_set1_epi32(1)), _mm256_set1_epi32(chain.maxLevel));
+
+		return LerpTexelsAVX2(BilinearSampleAVX2(chain, u, v, level, pass), BilinearSampleAVX2(chain, u, v, next, pass), weight);
+	}
+	}
+	return NearestSampleAVX2(chain, u, v, MipLevelAVX2(chain, footprint), pass);
+}
+
+TARGET_AVX2 bool SoftwareRasteriser::RasteriseTriRectAVX2(const ScreenTriangle &tri, int minX, int minY, int maxX, int maxY) {
+	bool depthWritten = false;
+
+	Vector2 origin((float)minX, (float)minY);
+
+	EdgeEquation alphaEdge(tri.v[1], tri.v[2], origin, tri.areaRecip);
+	EdgeEquation betaEdge (tri.v[2], tri.v[0], origin, tri.areaRecip);
+	EdgeEquation gammaEdge(tri.v[0], tri.v[1], origin, tri.areaRecip);
+
+	__m256 lanes		= _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+	__m256 zero			= _mm256_setzero_ps();
+	__m256 maxDepth		= _mm256_set1_ps(MAX_DEPTH);
+	__m256i laneIndex	= _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+
+	__m256 alphaStep	= _mm256_set1_ps(alphaEdge.stepX);
+	__m256 betaStep		= _mm256_set1_ps(betaEdge.stepX);
+	__m256 gammaStep	= _mm256_set1_ps(gammaEdge.stepX);
+
+	__m256 z0 = _mm256_set1_ps(tri.v[0].z);
+	__m256 z1 = _mm256_set1_ps(tri.v[1].z);
+	__m256 z2 = _mm256_set1_ps(tri.v[2].z);
+
+	__m256 channels[3][4];
+	__m256 texCoords[3][3];
+	__m256 texGradients[2][3];
+	memset(texGradients, 0, sizeof(texGradients));	//Only filled in for textured triangles
+	for (int i = 0; i < 3; ++i) {
+		for (int c = 0; c < 4; ++c) {
+			channels[i][c] = _mm256_set1_ps((float)((tri.colours[i].c >> (c * 8)) & 0xFF));
+		}
+		texCoords[i][0] = _mm256_set1_ps(tri.texCoords[i].x);
+		texCoords[i][1] = _mm256_set1_ps(tri.texCoords[i].y);
+		texCoords[i][2] = _mm256_set1_ps(tri.texCoords[i].z);
+	}
+
+	MipChain chain;
+	if (tri.texture) {
+		const Texture* t = tri.texture;
+
+		chain.texture		= t;
+		chain.compressed	= t->IsCompressed();
+		chain.texels		= t->texels;
+		chain.widths		= t->mipWidths;
+		chain.heights		= t->mipHeights;
+		chain.offsets		= t->mipOffsets;
+		chain.pitches		= t->mipPitches;
+		chain.layout		= t->layout;
+		chain.maxLevel		= (int)t->numMipLevels - 1;
+		chain.width			= (float)t->width;
+		chain.height		= (float)t->height;
+		chain.filter		= tri.textureFilter;
+
+		const Vector3* gradients[2] = { &tri.texGradientX, &tri.texGradientY };
+		for (int i = 0; i < 2; ++i) {
+			texGradients[i][0] = _mm256_set1_ps(gradients[i]->x);
+			texGradients[i][1] = _mm256_set1_ps(gradients[i]->y);
+			texGradients[i][2] = _mm256_set1_ps(gradients[i]->z);
+		}
+	}
+
+	for (int y = minY; y < maxY; ++y) {
+		__m256 alphaRow	= _mm256_set1_ps(alphaEdge.rowStart);
+		__m256 betaRow	= _mm256_set1_ps(betaEdge.rowStart);
+		__m256 gammaRow	= _mm256_set1_ps(gammaEdge.rowStart);
+
+		unsigned short* depthRow	= &depthBuffer[y * screenWidth];
+		Colour*			colourRow	= &buffers[currentDrawBuffer][y * screenWidth];
+
+		for (int x = minX; x < maxX; x += 8) {
+			int		count	= min(8, maxX - x);
+			bool	full	= (count == 8);
+
+			//Same sums as EdgeEquation::At
+			__m256 offset	= _mm256_add_ps(_mm256_set1_ps((float)(x - minX)), lanes);
+			__m256 alpha	= _mm256_add_ps(alphaRow, _mm256_mul_ps(offset, alphaStep));
+			__m256 beta		= _mm256_add_ps(betaRow,  _mm256_mul_ps(offset, betaStep));
+			__m256 gamma	= _mm256_add_ps(gammaRow, _mm256_mul_ps(offset, gammaStep));
+
+			__m256 inside = _mm256_and_ps(_mm256_and_ps(
+				_mm256_cmp_ps(alpha, zero, _CMP_GE_OQ),
+				_mm256_cmp_ps(beta,  zero, _CMP_GE_OQ)),
+				_mm256_cmp_ps(gamma, zero, _CMP_GE_OQ));
+			inside = _mm256_and_ps(inside, _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(count), laneIndex)));
+
+			if (_mm256_movemask_ps(inside) == 0) {
+				continue;
+			}
+
+			__m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(z0, alpha), _mm256_mul_ps(z1, beta)), _mm256_mul_ps(z2, gamma));
+			inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(z, zero, _CMP_GE_OQ), _mm256_cmp_ps(z, maxDepth, _CMP_LE_OQ)));
+
+			__m256i depth = _mm256_cvttps_epi32(z);
+			__m256i stored;
+
+			if (full) {
+				stored = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i*)&depthRow[x]));
+			}
+			else {
+				int partial[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+				for (int i = 0; i < count; ++i) {
+					partial[i] = depthRow[x + i];
+				}
+				stored = _mm256_loadu_si256((__m256i*)partial);
+			}
+
+			__m256i pass = _mm256_and_si256(_mm256_castps_si256(inside), DepthTestAVX2(tri.depthFunction, depth, stored));
+
+			if (_mm256_movemask_ps(_mm256_castsi256_ps(pass)) == 0) {
+				continue;
+			}
+
+			if (tri.depthWrite) {
+				__m256i newDepth = _mm256_blendv_epi8(stored, depth, pass);
+
+				if (full) {
+					__m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(newDepth), _mm256_extracti128_si256(newDepth, 1));
+					_mm_storeu_si128((__m128i*)&depthRow[x], packed);
+				}
+				else {
+					int partial[8];
+					_mm256_storeu_si256((__m256i*)partial, newDepth);
+					for (int i = 0; i < count; ++i) {
+						depthRow[x + i] = (unsigned short)partial[i];
+					}
+				}
+				depthWritten = true;
+			}
+
+			__m256i colours = tri.texture ?
+				SampleTextureAVX2(chain, texCoords, texGradients, alpha, beta, gamma, pass) :
+				InterpolateColourAVX2(channels, alpha, beta, gamma);
+
+			//Masked out lanes aren't touched at all, so this is safe at the tile edges
+			_mm256_maskstore_epi32((int*)&colourRow[x], pass, colours);
+		}
+		alphaEdge.NextRow();
+		betaEdge.NextRow();
+		gammaEdge.NextRow();
+	}
+	return depthWritten;
+}
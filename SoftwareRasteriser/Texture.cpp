@@ -1,43 +1,1003 @@
 #include "Texture.h"
+#include "MappedFile.h"
+#include "CPUFeatures.h"
+
+#include <immintrin.h>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+
+//Every set of blocks gets its own id, so a decoded block cache can never mix
+//up the blocks of a deleted texture with those of a new one at the same address
+static std::atomic<uint> nextBlockCacheId(1);
 
 Texture::Texture(void)	{
 	width	= 0;
 	height	= 0;
 
 	texels = NULL;
+	layout = TEXELS_LINEAR;
+
+	blocks			= NULL;
+	blockCacheId	= 0;
+
+	SetMipLayout(0, 0);
 }
 
 Texture::~Texture(void)	{
-	delete[] texels;
+	AlignedFree(texels);
+	AlignedFree(blocks);
+}
+
+Colour* Texture::AllocateTexels(uint count) {
+	size_t size = max((size_t)count, (size_t)1) * sizeof(Colour);
+
+	Colour* newTexels = (Colour*)AlignedAlloc(size, 64);
+	if (newTexels) {
+		memset((void*)newTexels, 0, size);
+	}
+	return newTexels;
+}
+
+/*
+The mip offsets and texel indices are all ints. TEXELS_TILED pads every level
+out to whole tiles, so its chain is the biggest of all the layouts - if that
+fits, they all do, and the texture can be freely moved between them.
+*/
+bool Texture::MipChainFits(uint newWidth, uint newHeight) {
+	unsigned long long levelWidth	= newWidth;
+	unsigned long long levelHeight	= newHeight;
+	unsigned long long total		= 0;
+
+	for (uint level = 0; level < MAX_MIP_LEVELS; ++level) {
+		unsigned long long tilesX = (levelWidth  + TEXEL_TILE_SIZE - 1) >> TEXEL_TILE_BITS;
+		unsigned long long tilesY = (levelHeight + TEXEL_TILE_SIZE - 1) >> TEXEL_TILE_BITS;
+
+		total += (tilesX * tilesY) << (TEXEL_TILE_BITS * 2);
+
+		if (levelWidth == 1 && levelHeight == 1) {
+			break;
+		}
+		levelWidth	= max(levelWidth  >> 1, 1ull);
+		levelHeight	= max(levelHeight >> 1, 1ull);
+	}
+	return total <= (unsigned long long)INT_MAX;
+}
+
+/*
+TGA files start with an 18 byte header, followed by an optional image ID 
+field, and an optional colour map, before the pixels themselves. Only the
+image types and pixel sizes below are understood - anything else, such as
+colour mapped images, is turned away.
+*/
+enum TGAImageType {
+	TGA_TRUE_COLOUR		= 2,
+	TGA_GREYSCALE		= 3,
+	TGA_RLE_TRUE_COLOUR	= 10,
+	TGA_RLE_GREYSCALE	= 11
+};
+
+static const size_t			TGA_HEADER_SIZE		= 18;
+static const unsigned char	TGA_RIGHT_TO_LEFT	= 0x10;	//Bits of the image descriptor byte
+static const unsigned char	TGA_TOP_TO_BOTTOM	= 0x20;
+static const unsigned char	TGA_RLE_RUN			= 0x80;	//Bit of an RLE packet header
+
+/*
+SSE4.1 versions of ExpandTGAPixels, for the 8 and 24 bit cases. They do as
+many pixels as they can without reading past the end of the input, and 
+return how many that was - ExpandTGAPixels does the rest a pixel at a time.
+*/
+TARGET_SSE41 static uint ExpandBGRSSE41(const unsigned char* in, Colour* out, uint count) {
+	__m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	__m128i alpha	= _mm_set1_epi32(0xFF000000);
+
+	uint done = 0;
+	//Each load takes 16 bytes, but only uses the first 12 of them
+	for (; done + 6 <= count; done += 4) {
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(in + (done * 3)));
+		_mm_storeu_si128((__m128i*)(out + done), _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), alpha));
+	}
+	return done;
+}
+
+TARGET_SSE41 static uint ExpandGreySSE41(const unsigned char* in, Colour* out, uint count) {
+	__m128i alpha = _mm_set1_epi32(0xFF000000);
+
+	uint done = 0;
+	for (; done + 16 <= count; done += 16) {
+		__m128i grey	= _mm_loadu_si128((const __m128i*)(in + done));
+		__m128i low		= _mm_unpacklo_epi8(grey, grey);
+		__m128i high	= _mm_unpackhi_epi8(grey, grey);
+
+		_mm_storeu_si128((__m128i*)(out + done),		_mm_or_si128(_mm_unpacklo_epi16(low, low),	 alpha));
+		_mm_storeu_si128((__m128i*)(out + done + 4),	_mm_or_si128(_mm_unpackhi_epi16(low, low),	 alpha));
+		_mm_storeu_si128((__m128i*)(out + done + 8),	_mm_or_si128(_mm_unpacklo_epi16(high, high), alpha));
+		_mm_storeu_si128((__m128i*)(out + done + 12),	_mm_or_si128(_mm_unpackhi_epi16(high, high), alpha));
+	}
+	return done;
+}
+
+/*
+Turns count pixels of the file's format into BGRA Colours. 32 bit pixels are
+already in the same order as a Colour, 24 bit ones get an alpha of 255, and
+greyscale ones have their value copied into all three colour channels.
+*/
+static void ExpandTGAPixels(const unsigned char* in, Colour* out, uint count, uint bytesPerPixel) {
+	bool useSSE = CPUFeatures::HasSSE41();
+	uint done	= 0;
+	switch (bytesPerPixel) {
+	case 4:
+		memcpy(out, in, count * sizeof(Colour));
+		return;
+	case 3:
+		if (useSSE) {
+			done = ExpandBGRSSE41(in, out, count);
+		}
+		for (; done < count; ++done) {
+			out[done] = Colour(in[(done * 3) + 2], in[(done * 3) + 1], in[done * 3], 255);
+		}
+		return;
+	case 1:
+		if (useSSE) {
+			done = ExpandGreySSE41(in, out, count);
+		}
+		for (; done < count; ++done) {
+			out[done] = Colour(in[done], in[done], in[done], 255);
+		}
+		return;
+	}
+}
+
+/*
+Hands out where each run of pixels from the file goes in the texture, in the
+order the file stores them. Runs never cross the end of a row, so images 
+stored top row first can be flipped the right way up as they're written.
+*/
+struct TGAPixelWriter {
+	TGAPixelWriter(Colour* texels, uint width, uint height, bool topToBottom) :
+		texels(texels), width(width), height(height), topToBottom(topToBottom), written(0) {
+	}
+
+	uint Remaining() const {
+		return (width * height) - written;
+	}
+
+	//Count is cut short if it would run past the end of the current row
+	Colour* NextSpan(uint &count) {
+		uint row	= written / width;
+		uint column	= written % width;
+
+		count	 = min(count, width - column);
+		written	+= count;
+
+		if (topToBottom) {
+			row = height - 1 - row;
+		}
+		return texels + (row * width) + column;
+	}
+
+	Colour*	texels;
+	uint	width;
+	uint	height;
+	bool	topToBottom;
+	uint	written;
+};
+
+static bool DecodeTGAPixels(const unsigned char* in, const unsigned char* end, TGAPixelWriter &writer, uint bytesPerPixel) {
+	if ((size_t)(end - in) < (size_t)writer.Remaining() * bytesPerPixel) {
+		return false;
+	}
+	while (writer.Remaining() > 0) {
+		uint	count	= writer.Remaining();
+		Colour*	out		= writer.NextSpan(count);
+
+		ExpandTGAPixels(in, out, count, bytesPerPixel);
+		in += count * bytesPerPixel;
+	}
+	return true;
 }
 
-Texture* Texture::TextureFromTGA(const string &filename) {
-	Texture * t = new Texture();
-	std::ifstream file;
+/*
+Every RLE packet starts with a byte saying how many pixels it covers. With 
+the top bit set, it's followed by a single pixel to repeat that many times - 
+otherwise, by that many pixels stored as normal. Plenty of programs let 
+packets carry on from one row into the next, so that's allowed here too.
+*/
+static bool DecodeTGAPixelsRLE(const unsigned char* in, const unsigned char* end, TGAPixelWriter &writer, uint bytesPerPixel) {
+	while (writer.Remaining() > 0) {
+		if (in >= end) {
+			return false;
+		}
+		unsigned char	header	= *in++;
+		uint			count	= (header & ~TGA_RLE_RUN) + 1;
+		bool			run		= (header & TGA_RLE_RUN) != 0;
+
+		size_t packetSize = run ? bytesPerPixel : (size_t)count * bytesPerPixel;
+
+		if (count > writer.Remaining() || (size_t)(end - in) < packetSize) {
+			return false;
+		}
+		if (run) {
+			Colour pixel;
+			ExpandTGAPixels(in, &pixel, 1, bytesPerPixel);
 
+			while (count > 0) {
+				uint	spanCount	= count;
+				Colour*	out			= writer.NextSpan(spanCount);
+
+				for (uint i = 0; i < spanCount; ++i) {
+					out[i] = pixel;
+				}
+				count -= spanCount;
+			}
+		}
+		else {
+			const unsigned char* pixels = in;
+
+			while (count > 0) {
+				uint	spanCount	= count;
+				Colour*	out			= writer.NextSpan(spanCount);
+
+				ExpandTGAPixels(pixels, out, spanCount, bytesPerPixel);
+				pixels	+= spanCount * bytesPerPixel;
+				count	-= spanCount;
+			}
+		}
+		in += packetSize;
+	}
+	return true;
+}
+
+/*
+The file is mapped rather than read, so the pixels are decoded straight out 
+of it into the texture, without being copied anywhere first. Returns NULL, 
+and says why, if the file can't be loaded.
+*/
+Texture* Texture::TextureFromTGA(const string &filename, TexelLayout layout) {
 	std::cout << "Loading TGA from(" << filename << ")" << std::endl;
-	file.open(filename.c_str(), std::ios::binary);
-	if(!file.is_open()){
-		std::cout << "TextureFromTGA file error" << std::endl;
-		return t ;
+
+	MappedFile file;
+	if (!file.Open(filename)) {
+		std::cout << "TextureFromTGA: Can't open " << filename << std::endl;
+		return NULL;
 	}
+	const unsigned char* data	= file.GetData();
+	const unsigned char* end	= data + file.GetSize();
 
-	unsigned char TGAheader[18];
+	if (file.GetSize() < TGA_HEADER_SIZE) {
+		std::cout << "TextureFromTGA: " << filename << " is too small to be a TGA" << std::endl;
+		return NULL;
+	}
 
-	std::cout << "sizeof(TGAheader) is " << sizeof(TGAheader) << std::endl;
+	uint idLength		= data[0];
+	uint colourMapType	= data[1];
+	uint imageType		= data[2];
+	uint mapLength		= data[5] + (data[6] << 8);
+	uint mapEntryBits	= data[7];
+	uint width			= data[12] + (data[13] << 8);
+	uint height			= data[14] + (data[15] << 8);
+	uint bitsPerPixel	= data[16];
+	uint descriptor		= data[17];
 
-	file.read((char*)TGAheader,sizeof(TGAheader));
+	bool greyscale	= (imageType == TGA_GREYSCALE		|| imageType == TGA_RLE_GREYSCALE);
+	bool trueColour	= (imageType == TGA_TRUE_COLOUR		|| imageType == TGA_RLE_TRUE_COLOUR);
+	bool rle		= (imageType == TGA_RLE_TRUE_COLOUR	|| imageType == TGA_RLE_GREYSCALE);
 
-	t->width	= (TGAheader[12] + (TGAheader[13] << 8));
-	t->height	= (TGAheader[14] + (TGAheader[15] << 8));
+	if (!greyscale && !trueColour) {
+		std::cout << "TextureFromTGA: " << filename << " has unsupported image type " << imageType << std::endl;
+		return NULL;
+	}
+	if ((greyscale && bitsPerPixel != 8) || (trueColour && bitsPerPixel != 24 && bitsPerPixel != 32)) {
+		std::cout << "TextureFromTGA: " << filename << " has unsupported " << bitsPerPixel << " bit pixels" << std::endl;
+		return NULL;
+	}
+	if (width == 0 || height == 0) {
+		std::cout << "TextureFromTGA: " << filename << " has no pixels" << std::endl;
+		return NULL;
+	}
+	if (!MipChainFits(width, height)) {
+		std::cout << "TextureFromTGA: " << filename << " is too big, at " << width << "x" << height << std::endl;
+		return NULL;
+	}
 
-	int size = t->width * t->height * (TGAheader[16] / 8);
+	//A true colour image may still carry a colour map, which we just skip over
+	size_t pixelStart = TGA_HEADER_SIZE + idLength;
+	if (colourMapType != 0) {
+		pixelStart += (size_t)mapLength * ((mapEntryBits + 7) / 8);
+	}
+	if (pixelStart > file.GetSize()) {
+		std::cout << "TextureFromTGA: " << filename << " ends before its pixels start" << std::endl;
+		return NULL;
+	}
 
-	t->texels = new Colour[t->width*t->height];
+	Texture* t = new Texture();
+	t->width	= width;
+	t->height	= height;
 
-	file.read( (char*) t->texels ,size);
-	file.close();
+	//Level 0 is decoded straight into the front of the chain, so it starts out
+	//linear, and is then tiled afterwards if need be
+	t->texels = AllocateTexels(t->SetMipLayout(width, height));
 
+	if (!t->texels) {
+		std::cout << "TextureFromTGA: Not enough memory to load " << filename << std::endl;
+		delete t;
+		return NULL;
+	}
+
+	TGAPixelWriter writer(t->texels, width, height, (descriptor & TGA_TOP_TO_BOTTOM) != 0);
+
+	uint bytesPerPixel = bitsPerPixel / 8;
+	bool decoded = rle ?
+		DecodeTGAPixelsRLE(data + pixelStart, end, writer, bytesPerPixel) :
+		DecodeTGAPixels(data + pixelStart, end, writer, bytesPerPixel);
+
+	if (!decoded) {
+		std::cout << "TextureFromTGA: " << filename << " is truncated, or has bad RLE data" << std::endl;
+		delete t;
+		return NULL;
+	}
+
+	if (descriptor & TGA_RIGHT_TO_LEFT) {
+		for (uint y = 0; y < height; ++y) {
+			std::reverse(t->texels + (y * width), t->texels + ((y + 1) * width));
+		}
+	}
+
+	t->GenerateMipMaps();
+
+	if (!t->SetTexelLayout(layout)) {
+		std::cout << "TextureFromTGA: Not enough memory to load " << filename << std::endl;
+		delete t;
+		return NULL;
+	}
 	return t;
 }
 
+uint Texture::SetMipLayout(uint newWidth, uint newHeight) {
+	numMipLevels	= 0;
+	mipOffsets[0]	= 0;
+
+	if (newWidth == 0 || newHeight == 0) {
+		return 0;
+	}
+
+	uint levelWidth		= newWidth;
+	uint levelHeight	= newHeight;
+
+	while (numMipLevels < MAX_MIP_LEVELS) {
+		uint levelSize;
+
+		if (layout != TEXELS_LINEAR) {
+			uint tilesX = (levelWidth  + TEXEL_TILE_SIZE - 1) >> TEXEL_TILE_BITS;
+			uint tilesY = (levelHeight + TEXEL_TILE_SIZE - 1) >> TEXEL_TILE_BITS;
+
+			mipPitches[numMipLevels]	= tilesX;
+			levelSize					= tilesX * tilesY;
+			if (layout == TEXELS_TILED) {
+				levelSize <<= (TEXEL_TILE_BITS * 2);
+			}
+		}
+		else {
+			mipPitches[numMipLevels]	= levelWidth;
+			levelSize					= levelWidth * levelHeight;
+		}
+
+		mipWidths[numMipLevels]			= levelWidth;
+		mipHeights[numMipLevels]		= levelHeight;
+		mipOffsets[numMipLevels + 1]	= mipOffsets[numMipLevels] + levelSize;
+		numMipLevels++;
+
+		if (levelWidth == 1 && levelHeight == 1) {
+			break;
+		}
+		levelWidth	= max(levelWidth  >> 1, 1u);
+		levelHeight	= max(levelHeight >> 1, 1u);
+	}
+	return mipOffsets[numMipLevels];
+}
+
+/*
+Each texel is the average of the 2x2 block of texels it covers in the level
+above. If a level is an odd size, the last row or column is repeated, so the
+block never reads off of the end of the level.
+*/
+void Texture::GenerateMipMaps() {
+	if (blocks) {
+		return;
+	}
+	for (uint level = 1; level < numMipLevels; ++level) {
+		int sourceWidth		= mipWidths[level - 1];
+		int sourceHeight	= mipHeights[level - 1];
+
+		for (int y = 0; y < mipHeights[level]; ++y) {
+			int y0 = min(y * 2,		sourceHeight - 1);
+			int y1 = min(y * 2 + 1,	sourceHeight - 1);
+
+			for (int x = 0; x < mipWidths[level]; ++x) {
+				int x0 = min(x * 2,		sourceWidth - 1);
+				int x1 = min(x * 2 + 1, sourceWidth - 1);
+
+				uint texel00 = texels[TexelIndex(x0, y0, level - 1)].c;
+				uint texel10 = texels[TexelIndex(x1, y0, level - 1)].c;
+				uint texel01 = texels[TexelIndex(x0, y1, level - 1)].c;
+				uint texel11 = texels[TexelIndex(x1, y1, level - 1)].c;
+
+				uint result = 0;
+
+				for (int shift = 0; shift < 32; shift += 8) {
+					uint sum =	((texel00 >> shift) & 0xFF) + ((texel10 >> shift) & 0xFF) +
+								((texel01 >> shift) & 0xFF) + ((texel11 >> shift) & 0xFF);
+
+					result |= ((sum + 2) >> 2) << shift;
+				}
+				texels[TexelIndex(x, y, level)].c = result;
+			}
+		}
+	}
+}
+
+bool Texture::SetTexelLayout(TexelLayout newLayout) {
+	if (newLayout == layout) {
+		return true;
+	}
+	if (blocks && !DecompressTexels()) {
+		return false;
+	}
+	if (newLayout == TEXELS_BC1 || newLayout == TEXELS_BC3) {
+		return CompressTexels(newLayout);
+	}
+	if (newLayout == layout) {
+		return true;	//Decompressing already left the texels linear
+	}
+	TexelLayout	oldLayout = layout;
+	Colour*		oldTexels = texels;
+	int			oldOffsets[MAX_MIP_LEVELS + 1];
+	int			oldPitches[MAX_MIP_LEVELS];
+
+	memcpy(oldOffsets, mipOffsets, sizeof(oldOffsets));
+	memcpy(oldPitches, mipPitches, sizeof(oldPitches));
+
+	layout = newLayout;
+	texels = AllocateTexels(SetMipLayout(width, height));
+
+	if (!texels) {
+		RestoreLayout(oldLayout, oldTexels, NULL);
+		return false;
+	}
+	if (oldTexels) {
+		for (uint level = 0; level < numMipLevels; ++level) {
+			for (int y = 0; y < mipHeights[level]; ++y) {
+				for (int x = 0; x < mipWidths[level]; ++x) {
+					texels[TexelIndex(x, y, level)] = oldTexels[oldOffsets[level] + SwizzleTexel(oldLayout, oldPitches[level], x, y)];
+				}
+			}
+		}
+	}
+	AlignedFree(oldTexels);
+	return true;
+}
+
+//Puts back the layout from before a failed change of it
+void Texture::RestoreLayout(TexelLayout oldLayout, Colour* oldTexels, unsigned char* oldBlocks) {
+	layout	= oldLayout;
+	texels	= oldTexels;
+	blocks	= oldBlocks;
+	SetMipLayout(width, height);
+}
+
+/*
+Texel centres are mapped the same way as NearestTextSample does, so u = 0 is
+the first texel and u = 1 the last - nearest sampling is then just this with
+the weights rounded down. Texels off the edges are clamped, like ColourAtPoint.
+*/
+Colour Texture::BilinearTextSample(const Vector3 &coords, int mipLevel) {
+	float x = coords.x * (mipWidths[mipLevel]  - 1);
+	float y = coords.y * (mipHeights[mipLevel] - 1);
+
+	float floorX = floorf(x);
+	float floorY = floorf(y);
+
+	int x0 = (int)floorX;
+	int y0 = (int)floorY;
+
+	int weightX = (int)((x - floorX) * 256.0f);
+	int weightY = (int)((y - floorY) * 256.0f);
+
+	Colour top		= LerpTexels(ColourAtPoint(x0, y0,		mipLevel), ColourAtPoint(x0 + 1, y0,	 mipLevel), weightX);
+	Colour bottom	= LerpTexels(ColourAtPoint(x0, y0 + 1,	mipLevel), ColourAtPoint(x0 + 1, y0 + 1, mipLevel), weightX);
+
+	return LerpTexels(top, bottom, weightY);
+}
+
+Colour Texture::TrilinearTextSample(const Vector3 &coords, float lod) {
+	int level	= (int)lod;
+	int weight	= (int)((lod - (float)level) * 256.0f);
+	int next	= min(level + 1, (int)numMipLevels - 1);
+
+	return LerpTexels(BilinearTextSample(coords, level), BilinearTextSample(coords, next), weight);
+}
+
+/*
+Both compressed layouts store each 4x4 block of texels as a pair of RGB565 
+endpoint colours, and a 2 bit index per texel choosing between those and the
+two colours a third and two thirds of the way between them. TEXELS_BC3 puts
+an alpha block in front of that, with a pair of 8 bit endpoint alphas, and a
+3 bit index per texel choosing between those and 6 alphas in between. These
+are the same as the BC1 and BC3 (DXT1 and DXT5) formats GPUs use.
+
+Inside a block, the texels run row by row, the same as a TEXELS_TILED tile.
+*/
+static inline uint ExpandRGB565(uint c, uint alpha) {
+	uint r = (c >> 11) & 31;
+	uint g = (c >> 5)  & 63;
+	uint b =  c        & 31;
+
+	r = (r << 3) | (r >> 2);
+	g = (g << 2) | (g >> 4);
+	b = (b << 3) | (b >> 2);
+
+	return (alpha << 24) | (r << 16) | (g << 8) | b;
+}
+
+//Blends each colour channel of a and b, as (a * weightA + b * weightB) / divisor
+static inline uint BlendBlockColours(uint a, uint b, uint weightA, uint weightB, uint divisor) {
+	uint result = 0xFF000000;
+	for (int shift = 0; shift < 24; shift += 8) {
+		uint channel = ((((a >> shift) & 0xFF) * weightA) + (((b >> shift) & 0xFF) * weightB)) / divisor;
+		result |= channel << shift;
+	}
+	return result;
+}
+
+/*
+A BC1 block whose first endpoint isn't bigger than its second has only one
+colour in between them, and uses its last index for transparent black. BC3's
+colour block always has the 4 colour palette.
+*/
+static void BlockColourPalette(uint c0, uint c1, bool allowTransparent, uint palette[4]) {
+	palette[0] = ExpandRGB565(c0, 255);
+	palette[1] = ExpandRGB565(c1, 255);
+
+	if (c0 > c1 || !allowTransparent) {
+		palette[2] = BlendBlockColours(palette[0], palette[1], 2, 1, 3);
+		palette[3] = BlendBlockColours(palette[0], palette[1], 1, 2, 3);
+	}
+	else {
+		palette[2] = BlendBlockColours(palette[0], palette[1], 1, 1, 2);
+		palette[3] = 0;
+	}
+}
+
+static void BlockAlphaPalette(uint a0, uint a1, uint palette[8]) {
+	palette[0] = a0;
+	palette[1] = a1;
+
+	if (a0 > a1) {
+		for (uint i = 2; i < 8; ++i) {
+			palette[i] = (((8 - i) * a0) + ((i - 1) * a1)) / 7;
+		}
+	}
+	else {
+		for (uint i = 2; i < 6; ++i) {
+			palette[i] = (((6 - i) * a0) + ((i - 1) * a1)) / 5;
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+static void DecodeBlock(const unsigned char* block, TexelLayout layout, uint out[16]) {
+	const unsigned char* colourBlock = (layout == TEXELS_BC3) ? block + 8 : block;
+
+	uint palette[4];
+	BlockColourPalette(colourBlock[0] | (colourBlock[1] << 8), colourBlock[2] | (colourBlock[3] << 8), layout == TEXELS_BC1, palette);
+
+	uint indices = colourBlock[4] | (colourBlock[5] << 8) | (colourBlock[6] << 16) | ((uint)colourBlock[7] << 24);
+	for (uint i = 0; i < 16; ++i) {
+		out[i] = palette[(indices >> (i * 2)) & 3];
+	}
+
+	if (layout == TEXELS_BC3) {
+		uint alphas[8];
+		BlockAlphaPalette(block[0], block[1], alphas);
+
+		unsigned long long alphaIndices = 0;
+		for (int i = 7; i >= 2; --i) {
+			alphaIndices = (alphaIndices << 8) | block[i];
+		}
+		for (uint i = 0; i < 16; ++i) {
+			out[i] = (out[i] & 0x00FFFFFF) | (alphas[(alphaIndices >> (i * 3)) & 7] << 24);
+		}
+	}
+}
+
+static inline uint ColourDistance(uint a, uint b) {
+	uint total = 0;
+	for (int shift = 0; shift < 24; shift += 8) {
+		int difference = (int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF);
+		total += difference * difference;
+	}
+	return total;
+}
+
+static inline uint PackRGB565(uint c) {
+	uint r = ((((c >> 16) & 0xFF) * 31) + 127) / 255;
+	uint g = ((((c >> 8)  & 0xFF) * 63) + 127) / 255;
+	uint b = ((( c        & 0xFF) * 31) + 127) / 255;
+
+	return (r << 11) | (g << 5) | b;
+}
+
+/*
+The endpoints are the two texels furthest apart along the direction the 
+block's colours vary the most in, found from their covariance by a few steps
+of power iteration. Each texel then takes whichever palette colour is nearest.
+*/
+static void EncodeColourBlock(const uint in[16], unsigned char* out) {
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (uint i = 0; i < 16; ++i) {
+		for (int c = 0; c < 3; ++c) {
+			mean[c] += (float)((in[i] >> (c * 8)) & 0xFF) / 16.0f;
+		}
+	}
+	float covariance[3][3] = { { 0.0f } };
+	for (uint i = 0; i < 16; ++i) {
+		float d[3];
+		for (int c = 0; c < 3; ++c) {
+			d[c] = (float)((in[i] >> (c * 8)) & 0xFF) - mean[c];
+		}
+		for (int a = 0; a < 3; ++a) {
+			for (int b = 0; b < 3; ++b) {
+				covariance[a][b] += d[a] * d[b];
+			}
+		}
+	}
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 4; ++iteration) {
+		float next[3];
+		float length = 0.0f;
+		for (int a = 0; a < 3; ++a) {
+			next[a] = (covariance[a][0] * axis[0]) + (covariance[a][1] * axis[1]) + (covariance[a][2] * axis[2]);
+			length	= max(length, fabsf(next[a]));
+		}
+		if (length <= 0.0f) {
+			break; //Every texel is the same colour
+		}
+		for (int a = 0; a < 3; ++a) {
+			axis[a] = next[a] / length;
+		}
+	}
+
+	uint	minTexel = in[0], maxTexel = in[0];
+	float	minDot	 = 0.0f,  maxDot   = 0.0f;
+	for (uint i = 0; i < 16; ++i) {
+		float dot = 0.0f;
+		for (int c = 0; c < 3; ++c) {
+			dot += (float)((in[i] >> (c * 8)) & 0xFF) * axis[c];
+		}
+		if (i == 0 || dot < minDot) {
+			minDot		= dot;
+			minTexel	= in[i];
+		}
+		if (i == 0 || dot > maxDot) {
+			maxDot		= dot;
+			maxTexel	= in[i];
+		}
+	}
+
+	uint c0 = PackRGB565(maxTexel);
+	uint c1 = PackRGB565(minTexel);
+	if (c0 < c1) {
+		std::swap(c0, c1);
+	}
+
+	uint palette[4];
+	BlockColourPalette(c0, c1, false, palette);
+
+	uint indices = 0;
+	if (c0 != c1) {
+		for (uint i = 0; i < 16; ++i) {
+			uint best = 0;
+			for (uint p = 1; p < 4; ++p) {
+				if (ColourDistance(in[i], palette[p]) < ColourDistance(in[i], palette[best])) {
+					best = p;
+				}
+			}
+			indices |= best << (i * 2);
+		}
+	}
+
+	out[0] = (unsigned char)(c0 & 0xFF);
+	out[1] = (unsigned char)(c0 >> 8);
+	out[2] = (unsigned char)(c1 & 0xFF);
+	out[3] = (unsigned char)(c1 >> 8);
+	for (int i = 0; i < 4; ++i) {
+		out[4 + i] = (unsigned char)(indices >> (i * 8));
+	}
+}
+
+static void EncodeAlphaBlock(const uint in[16], unsigned char* out) {
+	uint a0 = 0, a1 = 255;
+	for (uint i = 0; i < 16; ++i) {
+		a0 = max(a0, in[i] >> 24);
+		a1 = min(a1, in[i] >> 24);
+	}
+
+	uint palette[8];
+	BlockAlphaPalette(a0, a1, palette);
+
+	unsigned long long indices = 0;
+	if (a0 != a1) {
+		for (uint i = 0; i < 16; ++i) {
+			int	 alpha	= (int)(in[i] >> 24);
+			uint best	= 0;
+			for (uint p = 1; p < 8; ++p) {
+				if (abs(alpha - (int)palette[p]) < abs(alpha - (int)palette[best])) {
+					best = p;
+				}
+			}
+			indices |= (unsigned long long)best << (i * 3);
+		}
+	}
+
+	out[0] = (unsigned char)a0;
+	out[1] = (unsigned char)a1;
+	for (int i = 0; i < 6; ++i) {
+		out[2 + i] = (unsigned char)(indices >> (i * 8));
+	}
+}
+
+static unsigned char* AllocateBlocks(size_t count, size_t blockBytes) {
+	size_t size = max(count, (size_t)1) * blockBytes;
+
+	unsigned char* newBlocks = (unsigned char*)AlignedAlloc(size, 64);
+	if (newBlocks) {
+		memset(newBlocks, 0, size);
+	}
+	return newBlocks;
+}
+
+/*
+Blocks hanging off the right or bottom of a level that isn't a multiple of 4
+across are filled out by repeating its last column or row.
+*/
+bool Texture::CompressTexels(TexelLayout newLayout) {
+	TexelLayout	oldLayout = layout;
+	Colour*		oldTexels = texels;
+	int			oldOffsets[MAX_MIP_LEVELS + 1];
+	int			oldPitches[MAX_MIP_LEVELS];
+
+	memcpy(oldOffsets, mipOffsets, sizeof(oldOffsets));
+	memcpy(oldPitches, mipPitches, sizeof(oldPitches));
+
+	layout			= newLayout;
+	texels			= NULL;
+	blocks			= AllocateBlocks(SetMipLayout(width, height), GetBlockBytes(layout));
+
+	if (!blocks) {
+		RestoreLayout(oldLayout, oldTexels, NULL);
+		return false;
+	}
+	blockCacheId	= nextBlockCacheId++;
+
+	for (uint level = 0; oldTexels && level < numMipLevels; ++level) {
+		for (int blockY = 0; blockY * TEXEL_TILE_SIZE < mipHeights[level]; ++blockY) {
+			for (int blockX = 0; blockX < mipPitches[level]; ++blockX) {
+				uint source[16];
+				for (int i = 0; i < 16; ++i) {
+					int x = min((blockX * TEXEL_TILE_SIZE) + (i & 3),  mipWidths[level]  - 1);
+					int y = min((blockY * TEXEL_TILE_SIZE) + (i >> 2), mipHeights[level] - 1);
+
+					source[i] = oldTexels[oldOffsets[level] + SwizzleTexel(oldLayout, oldPitches[level], x, y)].c;
+				}
+				unsigned char* block = blocks + ((mipOffsets[level] + (blockY * mipPitches[level]) + blockX) * GetBlockBytes(layout));
+
+				if (layout == TEXELS_BC3) {
+					EncodeAlphaBlock(source, block);
+					EncodeColourBlock(source, block + 8);
+				}
+				else {
+					EncodeColourBlock(source, block);
+				}
+			}
+		}
+	}
+	AlignedFree(oldTexels);
+	return true;
+}
+
+//Leaves the texture TEXELS_LINEAR
+bool Texture::DecompressTexels() {
+	TexelLayout		oldLayout	= layout;
+	unsigned char*	oldBlocks	= blocks;
+	int				oldOffsets[MAX_MIP_LEVELS + 1];
+	int				oldPitches[MAX_MIP_LEVELS];
+
+	memcpy(oldOffsets, mipOffsets, sizeof(oldOffsets));
+	memcpy(oldPitches, mipPitches, sizeof(oldPitches));
+
+	layout	= TEXELS_LINEAR;
+	blocks	= NULL;
+	texels	= AllocateTexels(SetMipLayout(width, height));
+
+	if (!texels) {
+		RestoreLayout(oldLayout, NULL, oldBlocks);
+		return false;
+	}
+
+	for (uint level = 0; level < numMipLevels; ++level) {
+		for (int blockY = 0; blockY < (mipHeights[level] + TEXEL_TILE_SIZE - 1) / TEXEL_TILE_SIZE; ++blockY) {
+			for (int blockX = 0; blockX < oldPitches[level]; ++blockX) {
+				uint decoded[16];
+				DecodeBlock(oldBlocks + ((oldOffsets[level] + (blockY * oldPitches[level]) + blockX) * GetBlockBytes(oldLayout)), oldLayout, decoded);
+
+				for (int i = 0; i < 16; ++i) {
+					int x = (blockX * TEXEL_TILE_SIZE) + (i & 3);
+					int y = (blockY * TEXEL_TILE_SIZE) + (i >> 2);
+
+					if (x < mipWidths[level] && y < mipHeights[level]) {
+						texels[TexelIndex(x, y, level)].c = decoded[i];
+					}
+				}
+			}
+		}
+	}
+	AlignedFree(oldBlocks);
+	return true;
+}
+
+/*
+Each thread keeps the last few blocks it decoded, so sampling the same block
+over and over - as neighbouring pixels, and the 4 taps of a bilinear filter, 
+mostly do - only decodes it once. It's direct mapped, with the slot coming 
+from the bottom bits of the block's position, so any 8x8 area of blocks from
+one level fits without any of them pushing each other out.
+*/
+static const uint BLOCK_CACHE_SIZE = 64;
+
+struct DecodedBlockCache {
+	uint textureIds[BLOCK_CACHE_SIZE];		//0 for empty slots
+	uint blockIndices[BLOCK_CACHE_SIZE];
+	uint texels[BLOCK_CACHE_SIZE][16];
+};
+
+static THREAD_LOCAL DecodedBlockCache blockCache;
+
+Colour Texture::CompressedTexel(int x, int y, int mipLevel) const {
+	int blockX = x >> TEXEL_TILE_BITS;
+	int blockY = y >> TEXEL_TILE_BITS;
+
+	uint blockIndex = mipOffsets[mipLevel] + (blockY * mipPitches[mipLevel]) + blockX;
+
+	//Each level gets its own shuffle of the slots, so trilinear filtering's
+	//two levels don't keep evicting each other
+	uint slot = ((blockX & 7) | ((blockY & 7) << 3)) ^ ((mipLevel * 37) & (BLOCK_CACHE_SIZE - 1));
+
+	if (blockCache.textureIds[slot] != blockCacheId || blockCache.blockIndices[slot] != blockIndex) {
+		DecodeBlock(blocks + (blockIndex * GetBlockBytes(layout)), layout, blockCache.texels[slot]);
+		blockCache.textureIds[slot]		= blockCacheId;
+		blockCache.blockIndices[slot]	= blockIndex;
+	}
+
+	Colour result;
+	result.c = blockCache.texels[slot][((y & (TEXEL_TILE_SIZE - 1)) << TEXEL_TILE_BITS) + (x & (TEXEL_TILE_SIZE - 1))];
+	return result;
+}
+
+/*
+Compressed texture files are a fixed size header, followed by the blocks of
+every mip level, exactly as they're laid out in memory. Everything is stored
+little endian.
+*/
+static const char				COMPRESSED_TEXTURE_MAGIC[4]		= {'S', 'R', 'T', 'X'};
+static const uint				COMPRESSED_TEXTURE_VERSION		= 1;
+static const unsigned long long	COMPRESSED_TEXTURE_ALIGNMENT	= 64;
+
+struct CompressedTextureHeader {
+	char				magic[4];
+	uint				version;
+	uint				layout;			//TexelLayout - TEXELS_BC1 or TEXELS_BC3
+	uint				width;
+	uint				height;
+	uint				numMipLevels;
+	unsigned long long	blockOffset;	//Byte offset of the first block
+	unsigned long long	blockBytes;		//Size of every level's blocks together
+};
+
+Texture* Texture::LoadCompressedTexture(const string &filename) {
+	MappedFile file;
+
+	if (!file.Open(filename) || file.GetSize() < sizeof(CompressedTextureHeader)) {
+		return NULL;
+	}
+	CompressedTextureHeader header;
+	memcpy(&header, file.GetData(), sizeof(CompressedTextureHeader));
+
+	if (memcmp(header.magic, COMPRESSED_TEXTURE_MAGIC, 4) != 0 ||
+		header.version != COMPRESSED_TEXTURE_VERSION ||
+		(header.layout != TEXELS_BC1 && header.layout != TEXELS_BC3) ||
+		header.width == 0 || header.height == 0 ||
+		header.width > 0xFFFF || header.height > 0xFFFF ||
+		!MipChainFits(header.width, header.height)) {
+		return NULL;
+	}
+
+	Texture* t = new Texture();
+	t->width	= header.width;
+	t->height	= header.height;
+	t->layout	= (TexelLayout)header.layout;
+
+	uint numBlocks = t->SetMipLayout(t->width, t->height);
+
+	//The sizes all follow from the width and height, so have to match them -
+	//and the blocks have to fit in memory, on 32 bit builds
+	if (header.numMipLevels != t->numMipLevels ||
+		header.blockBytes	> (unsigned long long)SIZE_MAX ||
+		header.blockBytes	!= (unsigned long long)numBlocks * GetBlockBytes(t->layout) ||
+		header.blockOffset	< sizeof(CompressedTextureHeader) ||
+		header.blockOffset	> file.GetSize() ||
+		header.blockBytes	> file.GetSize() - header.blockOffset) {
+		delete t;
+		return NULL;
+	}
+
+	t->blocks		= AllocateBlocks(numBlocks, GetBlockBytes(t->layout));
+
+	if (!t->blocks) {
+		delete t;
+		return NULL;
+	}
+	t->blockCacheId	= nextBlockCacheId++;
+	memcpy(t->blocks, file.GetData() + header.blockOffset, (size_t)header.blockBytes);
+
+	return t;
+}
+
+bool Texture::SaveCompressedTexture(const string &filename) const {
+	if (!blocks) {
+		return false;
+	}
+	CompressedTextureHeader header;
+	memset(&header, 0, sizeof(CompressedTextureHeader));
+	memcpy(header.magic, COMPRESSED_TEXTURE_MAGIC, 4);
+
+	header.version		= COMPRESSED_TEXTURE_VERSION;
+	header.layout		= layout;
+	header.width		= width;
+	header.height		= height;
+	header.numMipLevels	= numMipLevels;
+	header.blockOffset	= (sizeof(CompressedTextureHeader) + COMPRESSED_TEXTURE_ALIGNMENT - 1) / COMPRESSED_TEXTURE_ALIGNMENT * COMPRESSED_TEXTURE_ALIGNMENT;
+	header.blockBytes	= (unsigned long long)mipOffsets[numMipLevels] * GetBlockBytes(layout);
+
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+	unsigned char padding[COMPRESSED_TEXTURE_ALIGNMENT];
+	memset(padding, 0, sizeof(padding));
+
+	bool written =
+		fwrite(&header, sizeof(CompressedTextureHeader), 1, file) == 1 &&
+		fwrite(padding, (size_t)header.blockOffset - sizeof(CompressedTextureHeader), 1, file) == 1 &&
+		fwrite(blocks, (size_t)header.blockBytes, 1, file) == 1;
+
+	return (fclose(file) == 0) && written;
+}
+
+bool Texture::ConvertTextureFile(const string &tgaFile, const string &compressedFile, TexelLayout layout) {
+	if (layout != TEXELS_BC1 && layout != TEXELS_BC3) {
+		return false;
+	}
+	Texture* t = TextureFromTGA(tgaFile, layout);
+
+	if (!t) {
+		return false;
+	}
+	bool saved = t->SaveCompressedTexture(compressedFile);
+	delete t;
+	return saved;
+}
@@ -10,12 +10,13 @@ Implements:
 Author:Rich Davison	<richard.davison4@newcastle.ac.uk>
 Description:Simple class to hold texture data for our software rasteriser.
 
-Later on in the tutorial series, the ability to performa mipmapping and 
-bilinear filtering is added to this class.
+Textures carry a full chain of mipmaps, built when the texture is loaded. The
+rasteriser picks which level to sample from using how quickly the texture 
+coordinates change across the screen, so textures far away don't sparkle.
 
-The provided TextureFromTGA function is very basic, and will only support
-uncompressed targa files - you can save images in this format using paint.net, 
-which is free
+TextureFromTGA reads 24 and 32 bit true colour, and 8 bit greyscale targa 
+files, either uncompressed or RLE compressed, stored either way up - you can 
+save images in this format using paint.net, which is free
 
 -_-_-_-_-_-_-_,------,   
 _-_-_-_-_-_-_-|   /\_/\   NYANYANYAN
@@ -31,42 +32,180 @@ using std::string;
 using std::ifstream;
 using std::vector;
 
+//Enough levels for a 32768 texel wide texture, which is far more than we'll see
+static const uint MAX_MIP_LEVELS = 16;
+
+//How the texels of each mip level are ordered in memory
+enum TexelLayout {
+	TEXELS_LINEAR,	//Row by row, like the image file
+	TEXELS_TILED,	//In 4x4 blocks, row by row within each block, and block by block across the level
+	TEXELS_BC1,		//4x4 blocks compressed to 8 bytes - 4 bits per texel, no alpha
+	TEXELS_BC3		//4x4 blocks compressed to 16 bytes - 8 bits per texel, with alpha
+};
+
+//Width and height of a block of TEXELS_TILED texels. 16 texels is 64 bytes, 
+//so with the texels 64 byte aligned, every block is exactly one cache line.
+//The compressed layouts use blocks of the same size.
+static const int TEXEL_TILE_BITS = 2;
+static const int TEXEL_TILE_SIZE = 1 << TEXEL_TILE_BITS;
+
+//Bytes taken up by each 4x4 block of the compressed layouts
+static const uint BC1_BLOCK_BYTES = 8;
+static const uint BC3_BLOCK_BYTES = 16;
+
 class Texture	{
 public:
 	friend class SoftwareRasteriser;
 	Texture(void);
 	~Texture(void);
 
-	static Texture* TextureFromTGA(const string &filename);
-	
-	const Colour& Texture::NearestTextSample(const Vector3 & coords){
-		int x = (int)(coords.x * (width - 1));
-		int y = (int)(coords.y *(height - 1));
-		return ColourAtPoint(x, y);
+	//Tiled textures should be fetched from just as quickly whichever way round
+	//the triangles using them are drawn, but so far haven't measured any
+	//faster than linear ones, so they're opt-in. Returns NULL if the file is
+	//missing, or can't be decoded.
+	static Texture* TextureFromTGA(const string &filename, TexelLayout layout = TEXELS_LINEAR);
 
+	//Loads a texture saved by SaveCompressedTexture - returns NULL if the file
+	//is missing, or isn't a valid compressed texture.
+	static Texture*	LoadCompressedTexture(const string &filename);
+	bool			SaveCompressedTexture(const string &filename) const;
 
+	//Loads a TGA, compresses it to TEXELS_BC1 or TEXELS_BC3, and saves it out
+	static bool		ConvertTextureFile(const string &tgaFile, const string &compressedFile, TexelLayout layout);
+	
+	Colour NearestTextSample(const Vector3 & coords, int mipLevel = 0){
+		int x = (int)(coords.x * (mipWidths[mipLevel]  - 1));
+		int y = (int)(coords.y * (mipHeights[mipLevel] - 1));
+		return ColourAtPoint(x, y, mipLevel);
 	}
 
-	const Colour&	ColourAtPoint(int x, int y, int mipLevel = 0) {
-		int texWidth  = width  >> mipLevel;
-		int texHeight = height >> mipLevel;
+	//Blends the 4 texels around the coordinates, from a single mip level
+	Colour	BilinearTextSample(const Vector3 &coords, int mipLevel = 0);
+
+	//Blends bilinear samples from the two mip levels either side of lod
+	Colour	TrilinearTextSample(const Vector3 &coords, float lod);
+
+	/*
+	Blends between a and b, with weight being how much of b to take, out of 
+	256. Every channel is worked out as ((a * (256 - weight)) + (b * weight) 
+	+ 128) >> 8, which always fits in 16 bits - so the SIMD samplers can do 
+	exactly the same thing, 8 channels to a register.
+	*/
+	static inline Colour LerpTexels(const Colour &a, const Colour &b, int weight) {
+		Colour result;
+		result.c = 0;
+		for (int shift = 0; shift < 32; shift += 8) {
+			uint channel = ((((a.c >> shift) & 0xFF) * (256 - weight)) + (((b.c >> shift) & 0xFF) * weight) + 128) >> 8;
+			result.c |= channel << shift;
+		}
+		return result;
+	}
+
+	Colour			ColourAtPoint(int x, int y, int mipLevel = 0) const {
+		int texWidth  = mipWidths[mipLevel];
+		int texHeight = mipHeights[mipLevel];
 
 		x = max(0,min(x,(int)texWidth-1));
 		y = max(0,min(y,(int)texHeight-1));
 
-		int index =  (y * texHeight) + x;
+		if (blocks) {
+			return CompressedTexel(x, y, mipLevel);
+		}
+		return texels[TexelIndex(x, y, mipLevel)];
+	}
+
+	//Where texel (x, y) of a mip level is in 'texels'. It has to be in the level!
+	inline int		TexelIndex(int x, int y, int mipLevel) const {
+		return mipOffsets[mipLevel] + SwizzleTexel(layout, mipPitches[mipLevel], x, y);
+	}
 
-		return texels[index];
+	/*
+	Position of a texel within a level. Pitch is how many texels there are to
+	a row for TEXELS_LINEAR, or how many 4x4 tiles for TEXELS_TILED. The SIMD
+	samplers do exactly the same thing.
+	*/
+	static inline int SwizzleTexel(TexelLayout l, int pitch, int x, int y) {
+		if (l == TEXELS_TILED) {
+			int tile = ((y >> TEXEL_TILE_BITS) * pitch) + (x >> TEXEL_TILE_BITS);
+			return (tile << (TEXEL_TILE_BITS * 2)) + ((y & (TEXEL_TILE_SIZE - 1)) << TEXEL_TILE_BITS) + (x & (TEXEL_TILE_SIZE - 1));
+		}
+		return (y * pitch) + x;
 	}
 
+	//Reorders every mip level into the new layout. Moving to one of the
+	//compressed layouts encodes the texels, which loses some detail - moving
+	//back out of one decodes them again, but can't get that detail back.
+	//Returns false, leaving the texture as it was, if it runs out of memory.
+	bool			SetTexelLayout(TexelLayout newLayout);
+	TexelLayout		GetTexelLayout() const { return layout;}
+
+	bool			IsCompressed() const { return blocks != NULL;}
+
 	uint	GetWidth()	{ return width;}
 	uint	GetHeight() { return height;}
 
+	//Every level of the mip chain, from the full size texture down to 1x1
+	uint	GetMipLevels() const { return numMipLevels;}
+
+	uint	GetMipWidth(uint level)		const { return mipWidths[level];}
+	uint	GetMipHeight(uint level)	const { return mipHeights[level];}
+
+	//In whatever order GetTexelLayout says - use TexelIndex to find a texel.
+	//NULL if the texture is compressed.
+	const Colour*	GetMipTexels(uint level) const { return texels ? texels + mipOffsets[level] : NULL;}
+
+	//Fills in every level past the first by box filtering the one above it.
+	//Needs calling again if the texels of level 0 are changed. Compressed 
+	//textures can't be changed, so this does nothing for them.
+	void	GenerateMipMaps();
+
+	size_t	GetMemorySize() const { return mipOffsets[numMipLevels] * (blocks ? GetBlockBytes(layout) : sizeof(Colour));}
 
 protected:
+	//Works out the size and offset of each level, for a width x height 
+	//texture in the current TexelLayout, and returns how many texels the whole
+	//chain takes up - tiled levels are padded out to whole tiles. For the
+	//compressed layouts, it's how many blocks, rather than texels.
+	uint	SetMipLayout(uint newWidth, uint newHeight);
+
+	//Returns NULL if there isn't enough memory
+	static Colour*	AllocateTexels(uint count);
+
+	//True if a width x height texture's mip chain can be indexed with ints,
+	//whatever its layout
+	static bool		MipChainFits(uint newWidth, uint newHeight);
+
+	void			RestoreLayout(TexelLayout oldLayout, Colour* oldTexels, unsigned char* oldBlocks);
+
+	static uint		GetBlockBytes(TexelLayout l) { return (l == TEXELS_BC3) ? BC3_BLOCK_BYTES : BC1_BLOCK_BYTES;}
+
+	//Finds a texel of a compressed texture, via the calling thread's cache of
+	//decoded blocks - so neighbouring fetches only decode each block once.
+	Colour			CompressedTexel(int x, int y, int mipLevel) const;
+
+	bool			CompressTexels(TexelLayout newLayout);
+	bool			DecompressTexels();
+
 	uint width;
 	uint height;
 
-	Colour* texels;
+	/*
+	All of the mip levels share the one allocation, one after the other, with
+	level 0 first - so the chain is only a third bigger than the texture, and
+	a small level sits right next to the one it was made from. The widths and
+	heights are kept as ints, so the SIMD samplers can gather them per pixel.
+	*/
+	Colour*			texels;		//64 byte aligned
+	TexelLayout		layout;
+
+	//Used in place of texels by the compressed layouts, with the mip offsets
+	//and pitches counted in blocks, rather than texels
+	unsigned char*	blocks;
+	uint			blockCacheId;	//Tells this texture's blocks apart in the decoded block caches
+
+	uint	numMipLevels;
+	int		mipWidths[MAX_MIP_LEVELS];
+	int		mipHeights[MAX_MIP_LEVELS];
+	int		mipPitches[MAX_MIP_LEVELS];	//Row length in texels, or in tiles
+	int		mipOffsets[MAX_MIP_LEVELS + 1];	//Last entry is the total size
 };
-
@@ -0,0 +1,79 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int numThreads)	{
+	runningJobs		= 0;
+	shuttingDown	= false;
+
+	if (numThreads < 0) {
+		int hardwareThreads = (int)std::thread::hardware_concurrency();
+		numThreads = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+	}
+
+	for (int i = 0; i < numThreads; ++i) {
+		workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool(void)	{
+	{
+		std::unique_lock<std::mutex> lock(queueMutex);
+		shuttingDown = true;
+	}
+	jobAdded.notify_all();
+
+	for (uint i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+}
+
+void ThreadPool::AddJob(const std::function<void()> &job) {
+	{
+		std::unique_lock<std::mutex> lock(queueMutex);
+		jobs.push_back(job);
+	}
+	jobAdded.notify_one();
+}
+
+void ThreadPool::WaitForJobs() {
+	std::unique_lock<std::mutex> lock(queueMutex);
+
+	while (RunNextJob(lock)) {
+	}
+
+	while (runningJobs > 0) {
+		jobFinished.wait(lock);
+	}
+}
+
+/*
+Takes a job off the front of the queue and runs it with the lock released.
+Returns false straight away if there's nothing left to do.
+*/
+bool ThreadPool::RunNextJob(std::unique_lock<std::mutex> &lock) {
+	if (jobs.empty()) {
+		return false;
+	}
+	std::function<void()> job = jobs.front();
+	jobs.pop_front();
+	++runningJobs;
+
+	lock.unlock();
+	job();
+	lock.lock();
+
+	--runningJobs;
+	if (runningJobs == 0 && jobs.empty()) {
+		jobFinished.notify_all();
+	}
+	return true;
+}
+
+void ThreadPool::WorkerLoop() {
+	std::unique_lock<std::mutex> lock(queueMutex);
+
+	while (!shuttingDown) {
+		if (!RunNextJob(lock)) {
+			jobAdded.wait(lock);
+		}
+	}
+}
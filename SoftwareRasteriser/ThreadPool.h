@@ -0,0 +1,56 @@
+/******************************************************************************
+Class:ThreadPool
+Implements:
+Description:A fixed set of worker threads that pull jobs off a shared queue.
+
+The rasteriser uses this to fill its screen tiles in parallel - each job is
+handed to whichever worker is free next. The thread that added the jobs can
+then call WaitForJobs, which has it help out with the queue rather than just
+sitting there until the workers are done.
+
+-_-_-_-_-_-_-_,------,   
+_-_-_-_-_-_-_-|   /\_/\   NYANYANYAN
+-_-_-_-_-_-_-~|__( ^ .^) /
+_-_-_-_-_-_-_-""  ""   
+
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+
+#include "Common.h"
+
+class ThreadPool	{
+public:
+	//A negative thread count will create one worker per hardware thread, minus
+	//one for the thread that owns the pool (as it helps out in WaitForJobs). 
+	//With 0 workers, WaitForJobs just runs every job on the calling thread.
+	ThreadPool(int numThreads = -1);
+	~ThreadPool(void);
+
+	void	AddJob(const std::function<void()> &job);
+
+	//Blocks until every job added so far has finished running
+	void	WaitForJobs();
+
+	uint	GetThreadCount() const { return (uint)workers.size();}
+
+protected:
+	void	WorkerLoop();
+	bool	RunNextJob(std::unique_lock<std::mutex> &lock);
+
+	std::vector<std::thread>			workers;
+	std::deque<std::function<void()> >	jobs;
+
+	std::mutex				queueMutex;
+	std::condition_variable	jobAdded;
+	std::condition_variable	jobFinished;
+
+	uint	runningJobs;
+	bool	shuttingDown;
+};
@@ -12,6 +12,7 @@ _-_-_-_-_-_-_-""  ""
 *//////////////////////////////////////////////////////////////////////////////
 #pragma once
 #include <iostream>
+#include <cmath>
 
 class Vector2	{
 public:
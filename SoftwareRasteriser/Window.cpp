@@ -1,6 +1,37 @@
 #include "Window.h"
 
-Window::Window(uint width, uint height)	{
+/*
+While less 'neat' than just doing a 'new', like in the tutorials, it's usually
+possible to render a bit quicker to use direct pointers to the drawing area
+that the OS gives you. For a bit of a speedup, you can uncomment the define below
+to switch to using this method.
+
+For those of you new to the preprocessor, here's a quick explanation:
+
+Preprocessor definitions like #define allow parts of a file to be selectively enabled
+or disabled at compile time. This is useful for hiding parts of the codebase on a
+per-platform basis: if you have support for linux and windows in your codebase, obviously
+the linux platform won't have the windows platform headers available, so compilation will
+fail. So instead you can hide away all the platform specific stuff:
+
+#if PLATFORM_WINDOWS
+ DoSomeWindowsStuff();
+#elif PLATFORM_LINUX
+ DoSomeLinuxStuff();
+ #else
+ #error Unsupported Platform Specified!
+ #endif
+
+ As in our usage, it also allows you to selectively compile in some different functionality
+ without any 'run time' cost - if it's not enabled by the preprocessor, it won't make it to
+ the compiler, so no assembly will be generated.
+
+The buffers now live in the RenderTarget, so that's where this switch has moved to,
+too - BuildBitmap hands the DIB memory over to it, in place of its own buffers.
+*/
+//#define USE_OS_BUFFERS
+
+Window::Window(uint width, uint height)	: RenderTarget(width, height) {
 	hasInit = false;
 	HINSTANCE hInstance = GetModuleHandle( NULL );
 
@@ -39,9 +70,7 @@ Window::Window(uint width, uint height)	{
 	RECT    rt; 
 	GetClientRect(windowHandle, &rt);
 
-	screenWidth		= rt.right;
-	screenHeight	= rt.bottom;
-
+	AllocateBuffers(rt.right, rt.bottom);
 	BuildBitmap();
 
 	Keyboard::Initialise(windowHandle);
@@ -81,6 +110,10 @@ void Window::BuildBitmap() {
 	for (int i = 0; i < 2; ++i) {
 		bitBuffers[i] = CreateDIBSection(drawDC, &bmi, DIB_RGB_COLORS, &bufferData[i], NULL, 0x0);
 	}
+
+#ifdef USE_OS_BUFFERS
+	UseExternalColourBuffers((Colour*)bufferData[0], (Colour*)bufferData[1]);
+#endif
 }
 
 void Window::PresentBuffer(Colour*buffer) {
@@ -135,12 +168,10 @@ LRESULT Window::WindowProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam
 			TrackMouseEvent(&tme);
 		}break;
 		case(WM_SIZE): {
-			screenWidth		= LOWORD(lParam);
-			screenHeight	= HIWORD(lParam);
-
+			//Any rasteriser drawing into us will see the buffers have changed,
+			//and resize itself to match the next time it draws
+			AllocateBuffers(LOWORD(lParam), HIWORD(lParam));
 			BuildBitmap();
-
-			Resize();
 		}break;
 
 		case(WM_SETFOCUS) : {
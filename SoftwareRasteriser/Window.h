@@ -1,6 +1,7 @@
 #pragma once
 #include "Common.h"
 #include "Colour.h"
+#include "RenderTarget.h"
 
 #include "Mouse.h"
 #include "Keyboard.h"
@@ -16,12 +17,12 @@
 #define WINDOWCLASS "WindowClass"
 
 //This is the OS-specific crap required to render our pixel blocks on screen
-class Window	{
+class Window : public RenderTarget	{
 public:
 	Window(uint width, uint height);
 	~Window(void);
 
-	void PresentBuffer(Colour*buffer);
+	virtual void PresentBuffer(Colour*buffer);
 
 	bool	UpdateWindow();	
 
@@ -30,10 +31,6 @@ protected:
 
 	void BuildBitmap();
 
-	virtual void Resize() {
-
-	};
-
 	//Windows requires a static callback function to handle certain incoming messages.
 	static LRESULT CALLBACK StaticWindowProc(HWND hWnd,UINT message,WPARAM wParam,LPARAM lParam);
 
@@ -42,10 +39,6 @@ protected:
 	HWND	windowHandle;	//OS handle
 	HDC		deviceContext;
 
-	uint	screenWidth;
-	uint	screenHeight;
-
-
 	HDC		drawDC;
 
 	HBITMAP bitBuffers[2];
@@ -1,14 +1,46 @@
 #include "SoftwareRasteriser.h"
+#include "Window.h"
+#include "Scene.h"
+#include "AssetLoader.h"
+#include "ResourceCache.h"
 
 #include "Mesh.h"
 #include "Texture.h"
 
-int main() {
+#include <iostream>
+
+int main(int argc, char** argv) {
 	
+	//Running as 'SoftwareRasteriser -convertmesh in.asciimesh out.mesh' just
+	//converts the mesh to the binary format, without opening a window
+	if (argc == 4 && string(argv[1]) == "-convertmesh") {
+		return Mesh::ConvertMeshFile(argv[2], argv[3]) ? 0 : 1;
+	}
+
+	//'SoftwareRasteriser -converttexture in.tga out.srtx [bc1|bc3]' compresses
+	//a texture the same way - BC1 unless asked for BC3, which keeps the alpha
+	if (argc >= 2 && string(argv[1]) == "-converttexture") {
+		string format = (argc == 5) ? argv[4] : "bc1";
+
+		if ((argc != 4 && argc != 5) || (format != "bc1" && format != "bc3")) {
+			std::cout << "Usage: SoftwareRasteriser -converttexture in.tga out.srtx [bc1|bc3]" << std::endl;
+			return 1;
+		}
+		TexelLayout layout = (format == "bc3") ? TEXELS_BC3 : TEXELS_BC1;
+		return Texture::ConvertTextureFile(argv[2], argv[3], layout) ? 0 : 1;
+	}
+
 	//This is my repo test
 
+	//Start loading before the window is made, so the two overlap
+	AssetLoader		loader;
+	TextureFuture	brick = loader.LoadTexture("../brick.tga");
 
-	SoftwareRasteriser r(1200, 738);
+	Window w(1200, 738);
+	SoftwareRasteriser r(w);
+
+	//Both triangles share the same mesh and texture
+	ResourceCache cache;
 	
 
 	Mesh * TestPoints = Mesh::GenerateStars();
@@ -17,16 +49,18 @@ int main() {
 	o1->modelMatrix = Matrix4::Translation(Vector3(0, 0, 0));
 
 	RenderObject *q1 = new RenderObject();
-	q1->mesh = Mesh::GenerateTriangle();
-	q1->texture = Texture::TextureFromTGA("../brick.tga");
+	q1->mesh = cache.GetGeneratedMesh("triangle", Mesh::GenerateTriangle);
+	q1->texture = cache.AddTexture("../brick.tga", brick.get());
 	q1->modelMatrix = Matrix4::Translation(Vector3(0, 0, -10));
+	q1->cullMode = CULL_BACK;
 	
 	
 	RenderObject *q2 = new RenderObject();
-	q2->mesh = Mesh::GenerateTriangle();
-	q2->texture = Texture::TextureFromTGA("../brick.tga");
+	q2->mesh = cache.GetGeneratedMesh("triangle", Mesh::GenerateTriangle);
+	q2->texture = cache.GetTexture("../brick.tga");
 	q2->modelMatrix = Matrix4::Translation(Vector3(0, 0, -10));
 	q2->modelMatrix = q2->modelMatrix * Matrix4::Rotation(180, Vector3(0, 1, 0));
+	q2->cullMode = CULL_BACK;
 
 
 	RenderObject *A1 = new RenderObject();
@@ -37,6 +71,13 @@ int main() {
 	A2->mesh = Mesh::GenerateShapes(Vector3(-2, 0, -20), Vector3(-2, -2, -20), Vector3(4, -3, -20), Vector3(3, 1, -20), Vector3(0, 1, -20), Vector3(-1, 4, -20));
 	A2->modelMatrix = Matrix4::Translation(Vector3(10, 11, -20));
 
+	Scene scene;
+	scene.AddObject(o1);
+	scene.AddObject(q1);
+	scene.AddObject(q2);
+	scene.AddObject(A1);
+	scene.AddObject(A2);
+
 	float aspect =1200.0f / 738.0f;
 	
 
@@ -46,16 +87,13 @@ int main() {
 	float yawY = 0.0f;
 
 	r.SetProjectionMatrix(Matrix4::Perspective(1.0f, 45.0f, aspect, 45.0f));
+	r.SetTextureFilter(FILTER_TRILINEAR);
 	
 
 
-	while(r.UpdateWindow()) {
+	while(w.UpdateWindow()) {
 		r.ClearBuffers();
-		r.DrawObject(o1);		
-		r.DrawObject(q1);
-		r.DrawObject(q2);
-		r.DrawObject(A1);
-		r.DrawObject(A2);
+		scene.Draw(r);
 		r.SwapBuffers();
 		
 		yaw = Mouse::GetRelativePosition().x;
@@ -139,8 +177,5 @@ int main() {
 		
 	}
 	delete o1->mesh;
-	delete o1;
-	delete q1->mesh;
-	delete q1;
 	return 0;
 }
\ No newline at end of file